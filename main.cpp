@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <chrono>
 #include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <map>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "poker.h"
 #include "util.h"
@@ -13,7 +16,9 @@ using namespace std;
 namespace {
 
 // Positions used by bench
-const vector<string> BenchPos = {
+// Bench positions of each deck, indexed by Deck::Index
+const vector<string> BenchPos[DECK_NB] = {
+  {
     "-p 2 3d 22+",
     "-p 3 KhKs 76s - Ac As 7c Ts Qs",
     "-p 4 -e AcTc TdTh JT - 5h 6h 9c 9d",
@@ -24,6 +29,19 @@ const vector<string> BenchPos = {
     "-p 9 [AA,QQ-99,AKs,T7s-T3s,AKo] [88+,T6s+,52o+] TT+",
     "-p 4 -e AhAd Ac 7c6s [66,T8s] - 2c 3c 4c",
     "-p 4 AhAd AcTh 7c6s 2h3h",
+  },
+  {
+    "-p 2 9d 66+",
+    "-p 3 KhKs 76s - Ac As 7c Ts Qs",
+    "-p 4 -e AcTc TdTh JT - 6h 7h 9c 9d",
+    "-p 5 6c7d KsTc AhTd - 8d 9d Jc Qd",
+    "-p 6 Ac Ad KsKd 7s - 6c 6h 7c 7h 8c",
+    "-p 7 Ad Kc QhJh 8s9s - 6c 6h 7c Th 8c",
+    "-p 8 - Ac Ah 9d 7h 8c",
+    "-p 9 [AA,QQ-99,AKs,T7s-T6s,AKo] [88+,T6s+,76o+] TT+",
+    "-p 4 -e AhAd Ac 7c6s [66,T8s] - 6h 7h 8h",
+    "-p 4 AhAd AcTh 7c6s 8h9h",
+  }
 };
 
 typedef chrono::milliseconds::rep TimePoint; // A value in milliseconds
@@ -35,6 +53,13 @@ TimePoint now()
         .count();
 }
 
+TimePoint now_us() // Same in microseconds
+{
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
 // Quick hash, see https://stackoverflow.com/questions/13325125/
 // lightweight-8-byte-hash-function-algorithm
 struct Hash {
@@ -46,37 +71,148 @@ struct Hash {
     uint64_t get() { return mix ^ (mix << 37); }
 };
 
-// Stores parsed args out of the position string
+// Phases of a query timed for the latency report
+enum Phase { PARSE, SPOT, RUN, OUTPUT, PHASE_NB };
+
+// Stores parsed args out of the position string. Args is reused across the
+// commands, so once its strings have grown parsing does not allocate anymore.
 struct Args {
     Result results[PLAYERS_NB];
     string pos;
     size_t gamesNum, threadsNum;
     int players;
-    bool enumerate;
+    Mode mode;
+    Shard shard;
+    string file;
+    string checkpoint, resume;
+    unsigned interval;
+    Binding binding;
+    bool latency;
+    bool omaha;
+    bool table; // Use the TableEval backend
+    unsigned interleave; // Games played together by each thread
+    Categories categories;
+    TimePoint phases[PHASE_NB]; // In microseconds
+    string cmd, token, value, commons; // Parsing buffers
 };
 
+// Parse a number of games, like 10000, 150K, 8M
+size_t parse_games(const string& g)
+{
+    char* end;
+    size_t n = strtoul(g.c_str(), &end, 10);
+    return n * (tolower(*end) == 'm' ? 1000 * 1000 : tolower(*end) == 'k' ? 1000 : 1);
+}
+
 void parse_args(istringstream& is, Args& parsed)
 {
     enum States { Option, Hole, Common };
 
-    map<string, string> args;
-    string token, value, sep = " ";
-    int holesCnt = 0;
+    string& token = parsed.token;
+    string& value = parsed.value;
+    bool enumerate = false, streets = false, categories = false;
+    const char* sep = " ";
+    int holesCnt = 0, players = -1;
     States st = Option;
 
+    parsed.pos.clear();
+    parsed.commons.clear();
+    parsed.file.clear();
+    parsed.checkpoint.clear();
+    parsed.resume.clear();
+    parsed.mode = MONTECARLO;
+    parsed.threadsNum = 1;
+    parsed.gamesNum = 1000 * 1000;
+    parsed.interval = 60;
+    parsed.binding = NO_BINDING;
+    parsed.shard = Shard();
+    parsed.latency = false;
+    parsed.omaha = false;
+    parsed.table = false;
+    parsed.interleave = 1;
+
     // Parse arguments
     while (is >> token) {
         if (st == Option) {
-            if (token == "-p" || token == "-t" || token == "-g") {
-                if (is >> value)
-                    args[token.substr(1, 1)] = value;
-                continue;
-            } else if (token == "-e") {
-                args["e"] = "true";
+            if (   token == "-e" || token == "-s" || token == "-c" || token == "--latency"
+                || token == "--omaha") {
+                enumerate |= token == "-e";
+                streets |= token == "-s";
+                categories |= token == "-c";
+                parsed.latency |= token == "--latency";
+                parsed.omaha |= token == "--omaha";
                 continue;
             } else if (token == "-") {
                 st = Common;
                 continue;
+            } else if (   token == "-p" || token == "-t" || token == "-g"
+                       || token == "-m" || token == "-o") {
+                if (!(is >> value))
+                    continue;
+
+                if (token == "-p")
+                    players = stoi(value);
+                else if (token == "-t")
+                    parsed.threadsNum = value == "auto" ? physical_cores() : stoi(value);
+                else if (token == "-g")
+                    parsed.gamesNum = parse_games(value);
+                else if (token == "-o")
+                    parsed.file = value;
+                else if (token == "-m") {
+                    parsed.mode = value == "std"        ? ESTIMATE
+                                : value == "strat"      ? STRATIFIED
+                                : value == "anti"       ? ANTITHETIC
+                                : value == "strat+anti" ? Mode(STRATIFIED | ANTITHETIC) : MONTECARLO;
+                    if (parsed.mode == MONTECARLO)
+                        cerr << "Unknown estimator: " << value << endl;
+                }
+                continue;
+            } else if (   token == "--shard" || token == "--checkpoint" || token == "--every"
+                       || token == "--resume" || token == "--bind" || token == "--eval"
+                       || token == "--interleave") {
+                if (!(is >> value))
+                    continue;
+
+                if (token == "--checkpoint")
+                    parsed.checkpoint = value;
+                else if (token == "--resume")
+                    parsed.resume = value;
+                else if (token == "--every")
+                    parsed.interval = stoi(value);
+                else if (token == "--interleave") {
+                    parsed.interleave = unsigned(stoi(value));
+                    if (parsed.interleave < 1 || parsed.interleave > MAX_INTERLEAVE) {
+                        cerr << "Interleaved games must be from 1 to " << MAX_INTERLEAVE << endl;
+                        parsed.interleave = 1;
+                    }
+                }
+                else if (token == "--eval") {
+                    parsed.table = value == "table";
+                    if (value != "table" && value != "bitboard")
+                        cerr << "Unknown evaluator: " << value << endl;
+                }
+                else if (token == "--bind") {
+                    parsed.binding = value == "compact" ? COMPACT
+                                   : value == "scatter" ? SCATTER
+                                   : value == "cores"   ? CORES : NO_BINDING;
+                    if (parsed.binding == NO_BINDING)
+                        cerr << "Unknown binding: " << value << endl;
+                }
+                else if (token == "--shard") {
+                    // Shard is given as i/n with i in [0..n-1]
+                    char* end;
+                    size_t i = strtoul(value.c_str(), &end, 10);
+                    size_t n = *end == '/' ? strtoul(end + 1, &end, 10) : 0;
+                    if (*end || i >= n)
+                        cerr << "Wrong shard: " << value << endl;
+                    else
+                        parsed.shard.idx = i, parsed.shard.num = n;
+
+                    if (parsed.file.empty())
+                        parsed.file = "shard_" + to_string(parsed.shard.idx) + "_"
+                                    + to_string(parsed.shard.num) + ".json";
+                }
+                continue;
             } else
                 st = Hole;
         }
@@ -89,86 +225,1868 @@ void parse_args(istringstream& is, Args& parsed)
                 sep = "";
             if (token.back() == ']')
                 sep = " ";
-            args["holes"] += token + sep;
+            parsed.pos += token;
+            parsed.pos += sep;
             holesCnt++;
         }
         if (st == Common)
-            args["commons"] += token;
+            parsed.commons += token;
+    }
+
+    // Process options, the estimator applies only to plain Monte Carlo
+    if (enumerate || streets)
+        parsed.mode = enumerate ? ENUMERATE : STREETS;
+
+    if (categories)
+        parsed.mode = Mode(parsed.mode | CATEGORIES);
+
+    parsed.players = players >= 0 ? players : holesCnt;
+    parsed.pos += "- ";
+    parsed.pos += parsed.commons;
+}
+
+// Spots of the last queries, so that a repeated query skips parsing of cards
+// and ranges. Entries are replaced round robin, and are stale once a named
+// range is redefined. A hit prints the ranges as a parse would. Note that only
+// parsing is saved: run() still allocates its Thread and work at each call.
+const Spot& cached_spot(int players, const string& pos)
+{
+    struct Entry {
+        int players;
+        unsigned generation;
+        string pos;
+        Spot spot;
+    };
+    static vector<Entry> cache(16);
+    static size_t next;
+    unsigned generation = ranges_generation();
+
+    for (Entry& e : cache)
+        if (   e.players == players && e.generation == generation
+            && e.pos == pos && e.spot.valid()) {
+            e.spot.print_ranges();
+            return e.spot;
+        }
+
+    Entry& e = cache[next++ % cache.size()];
+    e.players = players;
+    e.generation = generation;
+    e.pos = pos;
+    e.spot = Spot(players, pos);
+    return e.spot;
+}
+
+// Preflop counters of the 169 hand classes against 1 to 8 random opponents,
+// generated by 'preflop save' and read by 'preflop load'. Classes are indexed
+// as in the matrix grid: pairs on the diagonal, suited hands above it.
+struct PreflopTable {
+    size_t games = 0; // Games per entry, 0 if no table is loaded
+    Result results[13 * 13][PLAYERS_NB - 1][PLAYERS_NB];
+} Preflop;
+
+const string Values = "23456789TJQKA";
+
+// Index of the class of a 2 cards hand, or of a class name like AKs
+size_t preflop_class(unsigned v1, unsigned v2, bool suited)
+{
+    if (v1 < v2)
+        std::swap(v1, v2);
+
+    return suited ? (12 - v1) * 13 + 12 - v2 : (12 - v2) * 13 + 12 - v1;
+}
+
+size_t preflop_class(uint64_t holes)
+{
+    unsigned c1 = pop_lsb(&holes), c2 = lsb(holes);
+    return preflop_class(c1 & 0xF, c2 & 0xF, (c1 >> 4) == (c2 >> 4));
+}
+
+// A hand like AdKh of the class with the given index, and the class name
+string preflop_hand(size_t idx, string& name)
+{
+    unsigned r1 = idx / 13, r2 = idx % 13;
+    char v1 = Values[12 - std::min(r1, r2)], v2 = Values[12 - std::max(r1, r2)];
+
+    name = string(1, v1) + v2 + (r1 == r2 ? "" : r1 < r2 ? "s" : "o");
+    return string(1, v1) + "d" + v2 + (r1 < r2 ? "d" : "h");
+}
+
+// A hand followed street by street, set by 'position' and updated by 'board
+// add' and 'fold'. When the spot with a complete board can be enumerated, from
+// the flop on we keep the exact counters of each runout of the missing common
+// cards: a new common card just selects the runouts with it, without playing
+// any game. Ranges are interned, so rebuilding the spot after a fold reuses
+// them.
+struct Session {
+    Args args;
+    vector<string> holes; // Hole tokens of the players still in the hand
+    int players = 0;
+    uint64_t board;
+    Runouts runouts; // No boards when the counters are not exact
+} Live;
+
+// Cards like 'Ac 7d 2s' or 'Ac7d2s' as a bitboard, 0 on errors or double cards
+uint64_t parse_board(istream& is)
+{
+    string token;
+    uint64_t b = 0;
+    int cnt = 0;
+
+    while (is >> token)
+        for (size_t i = 0; i < token.size(); i += 2, cnt++) {
+            size_t v = Values.find(token[i]);
+            size_t c = i + 1 < token.size() ? string("dhcs").find(token[i + 1]) : string::npos;
+            if (v == string::npos || c == string::npos)
+                return 0;
+            b |= 1ULL << (16 * c + v);
+        }
+    return popcount(b) == cnt ? b : 0;
+}
+
+string board_string(uint64_t b)
+{
+    string s;
+    while (b) {
+        unsigned c = pop_lsb(&b);
+        s += Values[c % 16];
+        s += "dhcs"[c / 16];
+        s += " ";
+    }
+    return s;
+}
+
+// Set the complete boards out of the at most 2 missing common cards of a spot,
+// pairs of cards in lexicographic order. Return false if there are more, or if
+// the hands are not all given and the whole spot cannot be enumerated: the
+// runouts together cost as much as a full enumeration with -e. In this case,
+// with some games, these are split evenly among the runouts to sample them.
+bool set_runouts(const Spot& s, Runouts& ro, size_t games = 0)
+{
+    uint64_t board = s.common(), dead = board;
+    unsigned missing = 5 - popcount(board);
+    bool given = true;
+    vector<unsigned> deck;
+
+    for (size_t p = 0; p < s.players(); ++p) {
+        dead |= s.holes(p);
+        given &= popcount(s.holes(p)) == 2;
+    }
+    for (unsigned c = 0; c < 64; ++c)
+        if (in_deck(c) && !(dead & (1ULL << c)))
+            deck.push_back(c);
+
+    ro.boards.clear();
+
+    if (missing == 0)
+        ro.boards.push_back(board);
+
+    else if (missing == 1)
+        for (unsigned c : deck)
+            ro.boards.push_back(board | (1ULL << c));
+
+    else if (missing == 2)
+        for (size_t i = 0; i < deck.size(); ++i)
+            for (size_t j = i + 1; j < deck.size(); ++j)
+                ro.boards.push_back(board | (1ULL << deck[i]) | (1ULL << deck[j]));
+
+    ro.games = 0;
+    if (!given && !s.enumerable()) {
+        if (games && ro.boards.size())
+            ro.games = std::max(games / ro.boards.size(), size_t(1));
+        else
+            ro.boards.clear();
+    }
+    return ro.boards.size();
+}
+
+// Evaluate the session's spot after a change. With exact counters per runout
+// and a new common card we just drop the runouts without it, otherwise the
+// runouts are enumerated again, or a Monte Carlo is run on the current board.
+void session_update(bool rebuild)
+{
+    Session& ss = Live;
+    Args& args = ss.args;
+    Runouts& ro = ss.runouts;
+    string pos;
+
+    for (const string& h : ss.holes)
+        pos += h + " ";
+    pos += "- " + board_string(ss.board);
+
+    const Spot& s = cached_spot(ss.players, pos);
+    if (!s.valid() || ss.players < 2) {
+        cerr << "Error in: " << pos << endl;
+        ss.players = 0;
+        return;
+    }
+    std::fill(args.results, args.results + PLAYERS_NB, Result());
+
+    if ((rebuild || ro.boards.empty()) && set_runouts(s, ro)) {
+        Outputs out;
+        out.runouts = &ro;
+        run(s, 0, args.threadsNum, RUNOUTS, args.results, out, Shard(), args.binding);
+    }
+
+    if (ro.boards.size()) {
+        size_t cnt = 0;
+        std::fill(args.results, args.results + PLAYERS_NB, Result());
+
+        for (size_t k = 0; k < ro.boards.size(); ++k) {
+            if ((ro.boards[k] & ss.board) != ss.board)
+                continue;
+            for (int p = 0; p < ss.players; ++p) {
+                args.results[p].first += ro.results[k * PLAYERS_NB + p].first;
+                args.results[p].second += ro.results[k * PLAYERS_NB + p].second;
+            }
+            cnt++;
+        }
+        cout << "\nBoard: " << board_string(ss.board) << "exact over " << cnt
+             << " runouts" << endl;
+    } else {
+        Mode mode = args.mode & ENUMERATE ? ENUMERATE
+                  : s.vs_random() && s.runouts() ? VS_RANDOM : MONTECARLO;
+        cout << "\nBoard: " << board_string(ss.board) << endl;
+        run(s, args.gamesNum, args.threadsNum, mode, args.results, Outputs(), Shard(),
+            args.binding);
+    }
+    pretty_results(args.results, ss.players);
+}
+
+// Shard files store the raw counters of a shard in a small JSON object, one
+// key per line, like:
+//
+//  {
+//    "pos": "AcKd 7h7s - ",
+//    "players": 2,
+//    "mode": "montecarlo",
+//    "shard": 0,
+//    "shards": 4,
+//    "games": 250000,
+//    "results": [[119840, 63240], [127635, 63240]]
+//  }
+//
+// With -c there is also a "categories" key, with for each player the list of
+// the games made, the pots won and the tie shares of each hand category.
+bool save_shard(const Args& args)
+{
+    ofstream f(args.file);
+    uint64_t games = 0;
+
+    for (int p = 0; p < args.players; ++p)
+        games += KTie * uint64_t(args.results[p].first) + args.results[p].second;
+
+    if (!f) {
+        cerr << "Cannot write shard file: " << args.file << endl;
+        return false;
+    }
+    f << "{\n  \"pos\": \"" << args.pos << "\","
+      << "\n  \"players\": " << args.players << ","
+      << "\n  \"mode\": \"" << (args.mode & ENUMERATE ? "enumerate" : "montecarlo") << "\","
+      << "\n  \"shard\": " << args.shard.idx << ","
+      << "\n  \"shards\": " << args.shard.num << ","
+      << "\n  \"games\": " << games / KTie << ","
+      << "\n  \"results\": [";
+
+    for (int p = 0; p < args.players; ++p)
+        f << (p ? ", [" : "[") << args.results[p].first << ", "
+          << args.results[p].second << "]";
+
+    if (args.mode & CATEGORIES) {
+        f << "],\n  \"categories\": [";
+        for (int p = 0; p < args.players; ++p)
+            for (int c = 0; c < CATEGORY_NB; ++c)
+                f << (c ? ", " : p ? "], [" : "[") << args.categories.made[p][c] << ", "
+                  << args.categories.won[p][c].first << ", "
+                  << args.categories.won[p][c].second;
+        f << "]";
+    }
+    f << "]\n}\n";
+    cout << "\nShard " << args.shard.idx << "/" << args.shard.num
+         << " saved to " << args.file << endl;
+    return bool(f);
+}
+
+// Return the raw text of the value of a key in a JSON object written by
+// save_shard(): a string without the quotes, a number or an array.
+string json_value(const string& json, const string& key)
+{
+    size_t pos = json.find("\"" + key + "\":");
+    if (pos == string::npos)
+        return "";
+
+    pos = json.find_first_not_of(" ", pos + key.size() + 3);
+    if (pos == string::npos)
+        return "";
+
+    if (json[pos] == '"')
+        return json.substr(pos + 1, json.find('"', pos + 1) - pos - 1);
+
+    size_t end = json[pos] == '[' ? json.find("]]", pos) + 2 : json.find_first_of(",\n}", pos);
+    return json.substr(pos, end - pos);
+}
+
+bool load_shard(const string& file, Args& args)
+{
+    ifstream f(file);
+    stringstream ss;
+    ss << f.rdbuf();
+    string json = ss.str(), results = json_value(json, "results");
+    string categories = json_value(json, "categories");
+    auto blank = [](char c) { return c == '[' || c == ']' || c == ','; };
+
+    if (!f || results.empty()) {
+        cerr << "Cannot read shard file: " << file << endl;
+        return false;
+    }
+    args.pos = json_value(json, "pos");
+    args.players = stoi(json_value(json, "players"));
+    args.mode = json_value(json, "mode") == "enumerate" ? ENUMERATE : MONTECARLO;
+    args.shard.idx = stoul(json_value(json, "shard"));
+    args.shard.num = stoul(json_value(json, "shards"));
+    args.gamesNum = stoull(json_value(json, "games"));
+
+    // Results are a list of [win, tie] pairs, replace brackets and commas
+    // with blanks and read the numbers in sequence.
+    replace_if(results.begin(), results.end(), blank, ' ');
+    istringstream rs(results);
+    int p = 0;
+    while (p < PLAYERS_NB && rs >> args.results[p].first >> args.results[p].second)
+        p++;
+
+    // Categories, when present, are read the same way, in triples
+    bool ok = true;
+    if (categories.size()) {
+        args.mode = Mode(args.mode | CATEGORIES);
+        replace_if(categories.begin(), categories.end(), blank, ' ');
+        istringstream cs(categories);
+        for (int i = 0; i < args.players * CATEGORY_NB && ok; ++i) {
+            Result& w = args.categories.won[i / CATEGORY_NB][i % CATEGORY_NB];
+            ok = bool(cs >> args.categories.made[i / CATEGORY_NB][i % CATEGORY_NB]
+                          >> w.first >> w.second);
+        }
     }
 
-    // Process options
-    parsed.enumerate  = (args["e"] == "true");
-    parsed.threadsNum = (args["t"].size() ? stoi(args["t"]) : 1);
-    parsed.players    = (args["p"].size() ? stoi(args["p"]) : holesCnt);
+    if (!ok || p != args.players || args.shard.idx >= args.shard.num) {
+        cerr << "Corrupted shard file: " << file << endl;
+        return false;
+    }
+    return true;
+}
+
+// omaha() runs a Pot-Limit Omaha spot, by Monte Carlo or, when all the hole
+// cards are given, by full enumeration of the boards.
+void omaha(Args& args)
+{
+    Omaha o(args.players, args.pos);
+    if (!o.valid() || args.players < 2) {
+        cerr << "Error in: " << args.pos << endl;
+        return;
+    }
+    if (args.mode & ~ENUMERATE || args.shard.num > 1 || args.file.size() || args.checkpoint.size()) {
+        cerr << "Omaha supports only Monte Carlo and full enumeration" << endl;
+        return;
+    }
+    if ((args.mode & ENUMERATE) && !o.boards()) {
+        cerr << "Full enumeration needs all the hole cards" << endl;
+        return;
+    }
+    if (args.mode & ENUMERATE)
+        cout << "Evaluating " << o.boards() << " boards..." << endl;
 
-    if (args["g"].size()) {
-        string g = args["g"];
-        parsed.gamesNum = 1;
-        if (tolower(g.back()) == 'm')
-            parsed.gamesNum = 1000 * 1000, g.pop_back();
-        else if (tolower(g.back()) == 'k')
-            parsed.gamesNum = 1000, g.pop_back();
-        parsed.gamesNum *= stoi(g);
-    } else
-        parsed.gamesNum = 1000 * 1000;
+    // Games are played by the per thread copies of o
+    Outputs out;
+    out.omaha = &o;
+    std::fill(args.results, args.results + PLAYERS_NB, Result());
+    run(args.players, args.gamesNum, args.threadsNum, Mode(args.mode | OMAHA),
+        args.results, out, Shard(), args.binding);
 
-    parsed.pos = args["holes"] + "- " + args["commons"];
+    uint64_t games = 0;
+    for (int p = 0; p < args.players; ++p)
+        games |= args.results[p].first | args.results[p].second;
+    if (!games) {
+        cerr << "The ranges cannot be dealt together" << endl;
+        return;
+    }
+    pretty_results(args.results, args.players);
 }
 
 void go(istringstream& is, Args& args)
 {
+    TimePoint t0 = now_us();
+    Checkpoint cp;
+    string& cmd = args.cmd;
+
+    getline(is >> ws, cmd);
+    is.clear();
+    is.str(cmd); // Reuse the stream, cmd is needed by checkpoints
     parse_args(is, args);
 
-    Spot s(args.players, args.pos);
-    if (!s.valid()) {
+    // Continue from a checkpoint, with the arguments of the interrupted run
+    if (args.resume.size()) {
+        if (!load_checkpoint(args.resume, cp))
+            return;
+        cmd = cp.cmd;
+        istringstream rs(cmd);
+        parse_args(rs, args);
+    }
+
+    TimePoint t1 = now_us();
+
+    if (args.omaha) {
+        omaha(args);
+        return;
+    }
+
+    const Spot& s = cached_spot(args.players, args.pos);
+    if (!s.valid() || args.players < 2) {
         cerr << "Error in: " << args.pos << endl;
         return;
     }
+    Streets st;
+    Estimate est;
+    Outputs out;
     memset(args.results, 0, sizeof(args.results));
-    run(s, args.gamesNum, args.threadsNum, args.enumerate, args.results);
-    pretty_results(args.results, args.players);
+    memset(&st, 0, sizeof(st));
+    out.streets = &st;
+
+    if (args.shard.num > 1 || args.file.size() || args.checkpoint.size()) {
+        if (args.mode & ~(ENUMERATE | CATEGORIES)) {
+            cerr << "Shards and checkpoints support only Monte Carlo and full enumeration" << endl;
+            return;
+        }
+    }
+    if (args.mode & CATEGORIES) {
+        if (args.mode & ~(ENUMERATE | CATEGORIES)) {
+            cerr << "Categories support only Monte Carlo and full enumeration" << endl;
+            return;
+        }
+        if (args.checkpoint.size()) {
+            cerr << "Checkpoints do not support categories" << endl;
+            return;
+        }
+        args.categories = Categories();
+        out.categories = &args.categories;
+    }
+
+    // The first player against random opponents, preflop is a lookup in the
+    // table when loaded, with the board given is a single pass on the runouts.
+    bool lookup = false;
+    if (args.mode == MONTECARLO && s.vs_random()) {
+        if (   !s.common() && Preflop.games && args.shard.num == 1
+            && args.file.empty() && args.checkpoint.empty()) {
+            const Result* r = Preflop.results[preflop_class(s.holes(0))][args.players - 2];
+            std::copy(r, r + args.players, args.results);
+            cout << "Preflop table lookup" << endl;
+            lookup = true;
+        }
+        else if (s.runouts()) {
+            args.mode = VS_RANDOM;
+            cout << "Scoring all opponents' holes once on " << s.runouts()
+                 << " runouts" << endl;
+        }
+    }
+
+    if (args.mode & (ESTIMATE | STRATIFIED | ANTITHETIC)) {
+        if (!s.set_estimate(args.mode, est))
+            return;
+        est.samples = 0;
+        memset(est.sum, 0, sizeof(est.sum));
+        memset(est.sumSq, 0, sizeof(est.sumSq));
+        memset(est.mean, 0, sizeof(est.mean));
+        memset(est.var, 0, sizeof(est.var));
+        out.estimate = &est;
+    }
+    if (args.checkpoint.size()) {
+        if (cp.file.empty())
+            cp.file = args.checkpoint;
+        cp.cmd = cmd;
+        cp.interval = args.interval;
+        out.checkpoint = &cp;
+    }
+
+    TimePoint t2 = now_us();
+
+    if (args.table)
+        TableEval::init();
+
+    out.interleave = args.interleave;
+
+    if (!lookup)
+        run(s, args.gamesNum, args.threadsNum, Mode(args.mode | (args.table ? TABLE_EVAL : 0)),
+            args.results, out, args.shard, args.binding);
+
+    TimePoint t3 = now_us();
+
+    pretty_results(args.results, args.players, out.categories);
+
+    if (args.file.size())
+        save_shard(args);
+
+    if (args.mode == STREETS)
+        pretty_streets(st, args.players);
+
+    if (out.estimate)
+        pretty_estimate(est, args.players);
+
+    cout.flush();
+
+    TimePoint t4 = now_us();
+
+    args.phases[PARSE] = t1 - t0;
+    args.phases[SPOT] = t2 - t1;
+    args.phases[RUN] = t3 - t2;
+    args.phases[OUTPUT] = t4 - t3;
+
+    if (args.latency)
+        cout << "\nLatency (us): parse " << args.phases[PARSE]
+             << ", spot " << args.phases[SPOT] << ", run " << args.phases[RUN]
+             << ", output " << args.phases[OUTPUT] << ", total " << t4 - t0 << endl;
 }
 
-// bench() runs a benchmark for speed and signature
-void bench(istringstream& is)
+// matrix() computes the equity of each combo of the first player's range, all
+// the combos share the same sampled or enumerated boards and opponents' hands.
+void matrix(istringstream& is, Args& args)
 {
-    constexpr uint64_t GoodSig = 12568965866008609937ULL;
+    Matrix mx;
+    string hero, opponents;
 
-    Args args;
+    parse_args(is, args);
+
+    istringstream ss(args.pos);
+    ss >> hero;
+    getline(ss, opponents);
+
+    Spot s(args.players - 1, opponents);
+    if (!s.valid() || !parse_combos(hero, mx.combos)) {
+        cerr << "Error in: " << args.pos << endl;
+        return;
+    }
+    mx.results.resize(mx.combos.size());
+    mx.games.resize(mx.combos.size());
+
+    Outputs out;
+    out.matrix = &mx;
+    std::fill(args.results, args.results + PLAYERS_NB, Result());
+    run(s, args.gamesNum, args.threadsNum, Mode(args.mode | MATRIX), args.results, out,
+        Shard(), args.binding);
+    pretty_matrix(mx);
+}
+
+// compare() evaluates a list of spots separated by '|' with common random
+// numbers, options are given once before the first spot. It reports the first
+// player's equity in each spot and its difference with the first spot.
+void compare(istringstream& is, Args& args)
+{
+    Compare cmp;
     string token;
-    Hash sig;
-    uint64_t cards = 0, spots = 0, cnt = 0;
-    string threads = (is >> token) ? "-t " + token + " " : "-t 1 ";
+    vector<string> segments(1);
 
-    TimePoint elapsed = now();
+    while (is >> token)
+        if (token == "|")
+            segments.push_back("");
+        else
+            segments.back() += token + " ";
 
-    for (const string& pos : BenchPos) {
-        cerr << "\nPosition " << ++cnt << ": " << pos << endl;
-        istringstream ss(threads + pos);
-        go(ss, args);
+    for (size_t k = 0; k < segments.size(); ++k) {
+        Args a;
+        istringstream ss(segments[k]);
+        parse_args(ss, k ? a : args);
+
+        const Args& sa = k ? a : args;
+        cmp.spots.push_back(Spot(args.players, sa.pos));
+        if (!cmp.spots.back().valid() || args.players < 2 || sa.mode != MONTECARLO) {
+            cerr << "Error in: " << sa.pos << endl;
+            return;
+        }
+        segments[k] = sa.pos;
+    }
+    cmp.sum.resize(cmp.spots.size());
+    cmp.sumSq = cmp.diff = cmp.diffSq = cmp.sum;
+    cmp.games = 0;
+
+    std::fill(args.results, args.results + PLAYERS_NB, Result());
+    Outputs out;
+    out.compare = &cmp;
+    run(cmp.spots[0], args.gamesNum, args.threadsNum, COMPARE, args.results, out,
+        Shard(), args.binding);
+    pretty_compare(cmp, segments);
+}
+
+// merge() combines the counters of shard files of the same spot, written by go
+// with --shard, and prints the final equities.
+void merge(istringstream& is)
+{
+    Args total, a;
+    string file;
+    vector<bool> seen;
+    size_t cnt = 0;
+
+    std::fill(total.results, total.results + PLAYERS_NB, Result());
+    total.categories = Categories();
+    total.gamesNum = 0;
+
+    while (is >> file) {
+        if (!load_shard(file, a))
+            return;
+
+        if (!cnt) {
+            total.pos = a.pos, total.players = a.players;
+            total.mode = a.mode, total.shard = a.shard;
+            seen.resize(a.shard.num);
+        } else if (   a.pos != total.pos || a.players != total.players
+                   || a.mode != total.mode || a.shard.num != total.shard.num) {
+            cerr << "Shard file of a different run: " << file << endl;
+            return;
+        }
+        if (seen[a.shard.idx]) {
+            cerr << "Duplicated shard " << a.shard.idx << " in: " << file << endl;
+            return;
+        }
+        seen[a.shard.idx] = true;
+        cnt++;
+
+        for (int p = 0; p < a.players; ++p) {
+            total.results[p].first += a.results[p].first;
+            total.results[p].second += a.results[p].second;
+            for (int c = 0; c < CATEGORY_NB && (a.mode & CATEGORIES); ++c) {
+                total.categories.made[p][c] += a.categories.made[p][c];
+                total.categories.won[p][c].first += a.categories.won[p][c].first;
+                total.categories.won[p][c].second += a.categories.won[p][c].second;
+            }
+        }
+        total.gamesNum += a.gamesNum;
+    }
+    if (!cnt) {
+        cerr << "No shard files given" << endl;
+        return;
+    }
+    cout << "Merged " << cnt << " of " << total.shard.num << " shards of: "
+         << total.pos << endl;
+
+    if (cnt < total.shard.num)
+        cerr << "Warning: missing " << total.shard.num - cnt << " shards"
+             << (total.mode & ENUMERATE ? ", enumeration is not complete" : "")
+             << endl;
+
+    pretty_results(total.results, total.players,
+                   total.mode & CATEGORIES ? &total.categories : nullptr);
+}
+
+// preflop() saves or loads the table of the preflop counters of the 169 hand
+// classes against 1 to 8 random opponents, like 'preflop save file -g 10M -t 8'
+// or 'preflop load file'. Once loaded, go queries of a hand against random
+// opponents without common cards are answered by a lookup.
+void preflop(istringstream& is, Args& args)
+{
+    string action, file, name, token;
+
+    is >> action >> file;
 
+    if (action == "save") {
+        parse_args(is, args);
+        Preflop.games = args.gamesNum;
+
+        cout << "\nHand    vs 1    vs 2    vs 3    vs 4    vs 5    vs 6    vs 7    vs 8\n";
+
+        for (size_t idx = 0; idx < 13 * 13; ++idx) {
+            string pos = preflop_hand(idx, name) + " - ";
+
+            // Classes with cards not in the deck are left empty
+            if (!Spot(2, pos).valid()) {
+                for (Result* r : Preflop.results[idx])
+                    std::fill(r, r + PLAYERS_NB, Result());
+                continue;
+            }
+
+            cout << std::left << std::setw(4) << name << std::right;
+            for (int n = 2; n <= PLAYERS_NB; ++n) {
+                Result* r = Preflop.results[idx][n - 2];
+                std::fill(r, r + PLAYERS_NB, Result());
+                run(Spot(n, pos), args.gamesNum, args.threadsNum, MONTECARLO, r,
+                    Outputs(), Shard(), args.binding);
+                cout << std::setw(7) << std::fixed << std::setprecision(2)
+                     << (KTie * r[0].first + r[0].second) * 100.0 / KTie / args.gamesNum << "%";
+            }
+            cout << endl;
+        }
+
+        ofstream f(file);
+        f << "preflop 1\ngames " << Preflop.games << "\n";
+        for (size_t idx = 0; idx < 13 * 13; ++idx)
+            for (int n = 2; n <= PLAYERS_NB; ++n) {
+                preflop_hand(idx, name);
+                f << name << " " << n;
+                for (int p = 0; p < n; ++p)
+                    f << " " << Preflop.results[idx][n - 2][p].first
+                      << " " << Preflop.results[idx][n - 2][p].second;
+                f << "\n";
+            }
+        if (!f)
+            cerr << "Cannot write preflop table: " << file << endl;
+        else
+            cout << "\nPreflop table saved to " << file << endl;
+    }
+    else if (action == "load") {
+        ifstream f(file);
+        int n = 0;
+
+        f >> token >> action >> token >> Preflop.games;
+        if (token != "games" || action != "1") {
+            cerr << "Cannot read preflop table: " << file << endl;
+            Preflop.games = 0;
+            return;
+        }
+        // Each line is the class name, the players and their counters
+        for (size_t i = 0; i < 13 * 13 * (PLAYERS_NB - 1); ++i) {
+            f >> name >> n;
+            size_t v1 = Values.find(name[0]), v2 = Values.find(name[1]);
+            if (!f || v1 == string::npos || v2 == string::npos || n < 2 || n > PLAYERS_NB)
+                break;
+
+            Result* r = Preflop.results[preflop_class(v1, v2, name[2] == 's')][n - 2];
+            for (int p = 0; p < n; ++p)
+                f >> r[p].first >> r[p].second;
+        }
+        if (!f) {
+            cerr << "Corrupted preflop table: " << file << endl;
+            Preflop.games = 0;
+            return;
+        }
+        cout << "Preflop table of " << Preflop.games << " games per entry loaded from "
+             << file << endl;
+    }
+    else
+        cerr << "Usage: preflop save|load file [-g games] [-t threads]" << endl;
+}
+
+// outs() enumerates the next common card of a flop or turn spot, like 'outs -t 4
+// AhKh [QQ+,AK] - 2c 7d 9s', and reports the equities with each card and the
+// outs of the players: the cards that make them the leader, when they are not.
+// It is a single enumeration of all the runouts, one chunk of work per runout,
+// or when the spot cannot be enumerated the games of -g split among them.
+void outs(istringstream& is, Args& args)
+{
+    Runouts ro;
+    Outputs out;
+
+    parse_args(is, args);
+
+    const Spot& s = cached_spot(args.players, args.pos);
+    unsigned missing = 5 - popcount(s.common());
+    if (!s.valid() || args.players < 2 || missing < 1 || missing > 2) {
+        cerr << "Error in: " << args.pos << endl;
+        return;
+    }
+    if (!set_runouts(s, ro, args.gamesNum)) {
+        cerr << "Error in: " << args.pos << endl;
+        return;
+    }
+    if (ro.games)
+        cout << "Missing too many cards to enumerate, " << ro.games
+             << " games per runout" << endl;
+
+    out.runouts = &ro;
+    std::fill(args.results, args.results + PLAYERS_NB, Result());
+    run(s, 0, args.threadsNum, RUNOUTS, args.results, out, Shard(), args.binding);
+
+    // Counters with each next card, summed over the runouts including it.
+    // Runouts that leave a range with no combo have no games and are skipped.
+    vector<Result> cards(64 * PLAYERS_NB);
+    uint64_t next = 0;
+    for (size_t k = 0; k < ro.boards.size(); ++k) {
+        const Result* r = &ro.results[k * PLAYERS_NB];
+        uint64_t games = 0;
         for (int p = 0; p < args.players; ++p)
-            sig << args.results[p].first + args.results[p].second;
+            games |= r[p].first | r[p].second;
+        if (!games)
+            continue;
 
-        cards += args.gamesNum * (args.players * 2 + 5);
-        spots += args.gamesNum;
+        uint64_t b = ro.boards[k] & ~s.common();
+        next |= b;
+        while (b) {
+            unsigned c = pop_lsb(&b);
+            for (int p = 0; p < args.players; ++p) {
+                cards[c * PLAYERS_NB + p].first += r[p].first;
+                cards[c * PLAYERS_NB + p].second += r[p].second;
+            }
+        }
     }
 
-    elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+    // Players' equities out of their counters, return the leader
+    auto equities = [&](const Result* r, double eq[]) {
+        double games = 0;
+        int leader = 0;
+        for (int p = 0; p < args.players; ++p)
+            games += eq[p] = KTie * r[p].first + r[p].second;
+        for (int p = 0; p < args.players; ++p) {
+            eq[p] = games ? eq[p] / games : 0;
+            if (eq[p] > eq[leader])
+                leader = p;
+        }
+        return leader;
+    };
 
-    cerr << "\n==========================="
-         << "\nTotal time   : " << elapsed << " msec"
-         << "\nSpots played : " << spots / 1000000 << "M"
-         << "\nCards/second : " << 1000 * cards / elapsed
-         << "\nGames/second : " << 1000 * spots / elapsed
-         << "\nSignature    : " << sig.get();
+    double eq[PLAYERS_NB];
+    int leader = equities(args.results, eq);
+    vector<uint64_t> outsBB(args.players);
+
+    pretty_results(args.results, args.players);
 
-    if (sig.get() == GoodSig)
-        cerr << " (OK)";
-    else if (threads == "-t 1 ")
-        cerr << " (FAIL)";
+    cout << "\nCard ";
+    for (int p = 0; p < args.players; ++p)
+        cout << setw(7) << "P" << p + 1;
+    cout << "  Leader\n";
 
-    cerr << endl;
+    for (uint64_t b = next; b; ) {
+        unsigned c = pop_lsb(&b);
+        int l = equities(&cards[c * PLAYERS_NB], eq);
+        if (l != leader)
+            outsBB[l] |= 1ULL << c;
+
+        cout << board_string(1ULL << c) << " ";
+        for (int p = 0; p < args.players; ++p)
+            cout << setw(7) << fixed << setprecision(2) << eq[p] * 100 << "%";
+        cout << "  P" << l + 1 << (l != leader ? " *" : "") << "\n";
+    }
+
+    cout << "\nLeader with the board is P" << leader + 1 << "\n";
+    for (int p = 0; p < args.players; ++p)
+        if (outsBB[p])
+            cout << "Outs of P" << p + 1 << " (" << popcount(outsBB[p]) << "): "
+                 << board_string(outsBB[p]) << "\n";
+    cout.flush();
+}
+
+// flopsweep() evaluates a spot without common cards on each of its canonical
+// flops, like 'flopsweep -g 100K -t 8 -o sweep.csv [QQ+,AK] [JJ-77,AQs]', and
+// streams to a CSV file the equities with each flop, its multiplicity and its
+// deals, the combos of the ranges that can be dealt with it. Here -g is the
+// number of games per flop, with -e each flop is enumerated. Flops are run in
+// batches, each thread reusing its spot and ranges between flops.
+void flopsweep(istringstream& is, Args& args)
+{
+    vector<Stratum> flops;
+    vector<double> deals;
+    Runouts ro;
+    Outputs out;
+    double sum[PLAYERS_NB] = {}, weights = 0;
+
+    parse_args(is, args);
+
+    const Spot& s = cached_spot(args.players, args.pos);
+    if (!s.valid() || args.players < 2 || !s.flops(flops, deals)) {
+        cerr << "Error in: " << args.pos << endl;
+        return;
+    }
+    if (flops.empty()) {
+        cerr << "No flop can be dealt with the ranges" << endl;
+        return;
+    }
+    Spot flop = s;
+    flop.set_common(flops[0].cards);
+    if ((args.mode & ENUMERATE) && !flop.enumerable()) {
+        cerr << "Missing too many cards to enumerate a flop" << endl;
+        return;
+    }
+
+    string file = args.file.empty() ? "flopsweep.csv" : args.file;
+    ofstream f(file);
+    f << "flop,multiplicity,deals,games";
+    for (int p = 0; p < args.players; ++p)
+        f << ",p" << p + 1;
+    f << "\n" << fixed << setprecision(4);
+
+    cout << "Sweeping " << flops.size() << " flops to " << file << endl;
+
+    ro.games = args.mode & ENUMERATE ? 0 : args.gamesNum;
+    out.runouts = &ro;
+    std::fill(args.results, args.results + PLAYERS_NB, Result());
+
+    size_t batch = 16 * std::max(args.threadsNum, size_t(1));
+
+    for (size_t k = 0; k < flops.size(); k += batch) {
+        size_t end = std::min(k + batch, flops.size());
+
+        ro.boards.clear();
+        for (size_t i = k; i < end; ++i)
+            ro.boards.push_back(flops[i].cards);
+
+        run(s, 0, args.threadsNum, RUNOUTS, args.results, out, Shard(), args.binding);
+
+        for (size_t i = k; i < end; ++i) {
+            const Result* r = &ro.results[(i - k) * PLAYERS_NB];
+            uint64_t games = 0;
+            for (int p = 0; p < args.players; ++p)
+                games += KTie * r[p].first + r[p].second;
+
+            // Flop cards in descending face value, like AsKd2c
+            string name;
+            for (unsigned v = 13; v-- > 0; )
+                for (unsigned c = 0; c < 4; ++c)
+                    if (flops[i].cards & (1ULL << (16 * c + v)))
+                        name += board_string(1ULL << (16 * c + v)).substr(0, 2);
+
+            f << name << "," << int(flops[i].weight) << "," << uint64_t(deals[i])
+              << "," << games / KTie;
+            for (int p = 0; p < args.players; ++p) {
+                double eq = games ? double(KTie * r[p].first + r[p].second) / games : 0;
+                f << "," << eq * 100;
+                sum[p] += eq * flops[i].weight * deals[i];
+            }
+            f << "\n";
+            weights += flops[i].weight * deals[i];
+        }
+        f.flush();
+    }
+
+    if (!f) {
+        cerr << "Cannot write file: " << file << endl;
+        return;
+    }
+    cout << "\nMean equity over " << flops.size()
+         << " flops, weighted by multiplicity and deals\n";
+    for (int p = 0; p < args.players; ++p)
+        cout << "P" << p + 1 << ": " << setw(6) << fixed << setprecision(2)
+             << sum[p] * 100 / weights << "%\n";
+    cout.flush();
+}
+
+// Layout of the hand strength tables written by 'ehs': a header, the index of
+// the boards sorted by cards, with a last sentinel, then the entries of each
+// board sorted by hole, starting at a cache line. Cards are encoded as in the
+// deck the table was generated with, stored as its Deck::Index.
+struct EhsHeader {
+    char magic[8];
+    uint32_t commons, bins;
+    uint32_t deck, unused;
+    uint64_t boards, entries;
+    uint64_t indexOffset, entriesOffset;
+};
+
+struct EhsIndex {
+    uint64_t board;
+    uint64_t first; // Index of the first entry of the board
+};
+
+const char EhsMagic[8] = "ehs 2";
+
+// Write the hand strength table of a street, boards are split in batches run
+// in parallel and streamed to the file.
+void ehs_save(const string& file, unsigned commons, Args& args)
+{
+    vector<uint64_t> boards, holes;
+    HandStrength hs;
+    Outputs out;
+    EhsHeader hd = {};
+
+    canonical_boards(commons, boards);
+
+    // Count the canonical holes of each board to build the index upfront
+    vector<EhsIndex> index;
+    for (uint64_t b : boards) {
+        canonical_holes(b, holes);
+        index.push_back({ b, hd.entries });
+        hd.entries += holes.size();
+    }
+    index.push_back({ ~0ULL, hd.entries });
+
+    std::copy(EhsMagic, EhsMagic + 8, hd.magic);
+    hd.commons = commons;
+    hd.bins = BINS_NB;
+    hd.deck = Deck::Index;
+    hd.boards = boards.size();
+    hd.indexOffset = sizeof(hd);
+    hd.entriesOffset = (sizeof(hd) + index.size() * sizeof(EhsIndex) + 63) / 64 * 64;
+
+    ofstream f(file, ios::binary);
+    f.write(reinterpret_cast<const char*>(&hd), sizeof(hd));
+    f.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(EhsIndex));
+    f.write(string(hd.entriesOffset - f.tellp(), '\0').data(), hd.entriesOffset - f.tellp());
+
+    cout << "Hand strength of " << hd.entries << " canonical holes on " << boards.size()
+         << " boards of " << commons << " cards to " << file << endl;
+
+    out.strength = &hs;
+    size_t batch = 64 * std::max(args.threadsNum, size_t(1)), done = 0;
+    TimePoint start = now(), last = start;
+
+    for (size_t k = 0; k < boards.size(); k += batch) {
+        size_t end = std::min(k + batch, boards.size());
+
+        hs.boards.assign(boards.begin() + k, boards.begin() + end);
+        hs.first.clear();
+        hs.entries.clear();
+        for (uint64_t b : hs.boards) {
+            canonical_holes(b, holes);
+            hs.first.push_back(hs.entries.size());
+            for (uint64_t h : holes)
+                hs.entries.push_back({ h, 0, 0, 0, {}, 0 });
+        }
+        hs.first.push_back(hs.entries.size());
+
+        run(0, 0, args.threadsNum, HAND_STRENGTH, args.results, out, Shard(), args.binding);
+
+        f.write(reinterpret_cast<const char*>(hs.entries.data()),
+                hs.entries.size() * sizeof(EhsEntry));
+        done += hs.entries.size();
+
+        if (now() - last >= 1000 || end == boards.size()) {
+            last = now();
+            cout << "Boards " << end << "/" << boards.size() << ", entries " << done
+                 << ", " << 1000 * done / (last - start + 1) << " entries/second" << endl;
+        }
+    }
+
+    if (!f)
+        cerr << "Cannot write file: " << file << endl;
+    else
+        cout << "Done in " << (now() - start) / 1000.0 << " seconds" << endl;
+}
+
+// Look up the strength of a hole on a board in a table, mapped from disk
+void ehs_lookup(const string& file, istringstream& is)
+{
+    string token;
+    size_t size = 0;
+    is >> token;
+    istringstream hs(token);
+    uint64_t hole = parse_board(hs), board = parse_board(is);
+
+    if (popcount(hole) != 2 || (hole & board) || ((hole | board) & Deck::Absent)) {
+        cerr << "Usage: ehs lookup FILE hole board" << endl;
+        return;
+    }
+    const char* p = static_cast<const char*>(map_file(file, size));
+    const EhsHeader* hd = reinterpret_cast<const EhsHeader*>(p);
+
+    // The index, sentinel included, and the entries must be within the file
+    if (   !p || size < sizeof(EhsHeader) || string(hd->magic) != EhsMagic
+        || hd->bins != BINS_NB
+        || hd->indexOffset > size || hd->entriesOffset > size
+        || hd->boards >= (size - hd->indexOffset) / sizeof(EhsIndex)
+        || hd->entries > (size - hd->entriesOffset) / sizeof(EhsEntry)) {
+        cerr << "Cannot read hand strength table: " << file << endl;
+        if (p)
+            unmap_file(p, size);
+        return;
+    }
+    if (hd->deck != Deck::Index) {
+        cerr << "Table is for the " << (hd->deck ? "short" : "full") << " deck" << endl;
+        unmap_file(p, size);
+        return;
+    }
+    if (popcount(board) != int(hd->commons)) {
+        cerr << "Table is for boards of " << hd->commons << " cards" << endl;
+        unmap_file(p, size);
+        return;
+    }
+    const EhsIndex* idx = reinterpret_cast<const EhsIndex*>(p + hd->indexOffset);
+    const EhsEntry* entries = reinterpret_cast<const EhsEntry*>(p + hd->entriesOffset);
+    const EhsEntry* e = nullptr;
+
+    canonical_form(hole, board);
+
+    auto b = std::lower_bound(idx, idx + hd->boards, board,
+                              [](const EhsIndex& i, uint64_t v) { return i.board < v; });
+
+    if (   b != idx + hd->boards && b->board == board
+        && b->first <= (b + 1)->first && (b + 1)->first <= hd->entries) {
+        e = std::lower_bound(entries + b->first, entries + (b + 1)->first, hole,
+                             [](const EhsEntry& i, uint64_t v) { return i.hole < v; });
+        if (e == entries + (b + 1)->first || e->hole != hole)
+            e = nullptr;
+    }
+    if (!e) {
+        cerr << "Not in table: " << board_string(hole) << "- " << board_string(board) << endl;
+        unmap_file(p, size);
+        return;
+    }
+
+    cout << "Canonical " << board_string(hole) << "- " << board_string(board) << endl
+         << fixed << setprecision(4) << "EHS " << e->ehs << ", EHS2 " << e->ehs2
+         << " over " << e->runouts << " runouts\nHistogram";
+    for (int i = 0; i < BINS_NB; ++i)
+        cout << " " << e->histo[i];
+    cout << endl;
+
+    unmap_file(p, size);
+}
+
+// ehs() writes the expected hand strength table of the flop, turn or river,
+// like 'ehs turn turn.ehs -t 8', or looks up an entry, like 'ehs lookup
+// turn.ehs AhKh 2c7d9sTs'.
+void ehs(istringstream& is, Args& args)
+{
+    string action, file;
+
+    is >> action >> file;
+    unsigned commons = action == "flop" ? 3 : action == "turn" ? 4 : action == "river" ? 5 : 0;
+
+    if (action == "lookup")
+        ehs_lookup(file, is);
+
+    else if (commons && file.size()) {
+        parse_args(is, args);
+        ehs_save(file, commons, args);
+    }
+    else
+        cerr << "Usage: ehs flop|turn|river FILE [-t threads] | ehs lookup FILE hole board" << endl;
+}
+
+// An all-in of a hand history: the players still in the hand with their hole
+// cards, the board when the betting was over and the folded cards seen.
+struct AllIn {
+    string id;
+    int street;
+    vector<string> names;
+    vector<uint64_t> holes;
+    uint64_t board, dead;
+};
+
+// Cards of all the [..] groups of a history line, like '[2c 3d 4h] [5s]'
+uint64_t history_cards(const string& line)
+{
+    uint64_t b = 0;
+    size_t open = 0, close;
+
+    while (   (open = line.find('[', open)) != string::npos
+           && (close = line.find(']', open)) != string::npos) {
+        istringstream ss(line.substr(open + 1, close - open - 1));
+        b |= parse_board(ss);
+        open = close;
+    }
+    return b;
+}
+
+// Parse a PokerStars Hold'em hand history record, one line per element, and
+// set its all-in if there is one: a player is all-in and the hole cards of all
+// the players still in the hand are known, shown or dealt to us. The spot is at
+// the street where the last all-in was called, with the players not folded by
+// its end, folded cards seen are dead. Hands where the players with chips left
+// still bet, call or fold on a later street play side pots and are skipped.
+bool parse_history(const vector<string>& lines, AllIn& a)
+{
+    const string Streets[] = { "*** FLOP ***", "*** TURN ***", "*** RIVER ***" };
+    const string Actions[] = { "folds", "checks", "calls", "bets", "raises", "posts" };
+    const string& head = lines[0];
+    vector<string> seats, acted, folded;
+    vector<pair<string, uint64_t>> known;
+    uint64_t boards[4] = {};
+    int current = 0, called = -1, lastAction = 0;
+    bool allIn = false, over = false;
+
+    size_t pos = head.find("Hand #");
+    if (head.compare(0, 10, "PokerStars") || pos == string::npos
+        || head.find("Hold'em") == string::npos)
+        return false;
+
+    a.id = head.substr(pos + 6, head.find(':', pos) - pos - 6);
+
+    for (const string& l : lines) {
+
+        // Seats are listed before the blinds, like 'Seat 3: name ($100 in chips)',
+        // and again in the summary, with the cards shown or mucked.
+        if (!l.compare(0, 5, "Seat ")) {
+            size_t c = l.find(": "), e = l.rfind(" (", l.find(" in chips"));
+            if (over && l.find('[') != string::npos)
+                for (const string& s : seats)
+                    if (!l.compare(c + 2, s.size(), s) && l[c + 2 + s.size()] == ' ')
+                        known.emplace_back(s, history_cards(l));
+            if (!over && !current && c != string::npos && e != string::npos && e > c)
+                seats.push_back(l.substr(c + 2, e - c - 2));
+            continue;
+        }
+        if (!l.compare(0, 9, "Dealt to ") && l.find('[') != string::npos) {
+            known.emplace_back(l.substr(9, l.rfind(" [") - 9), history_cards(l));
+            continue;
+        }
+        if (!l.compare(0, 4, "*** ")) {
+            for (int s = 0; s < 3; ++s)
+                if (!l.compare(0, Streets[s].size(), Streets[s])) {
+                    boards[current = s + 1] = history_cards(l);
+                    allIn = false; // An all-in of this street is yet to come
+                }
+            over |=    !l.compare(0, 17, "*** SHOW DOWN ***")
+                    || !l.compare(0, 15, "*** SUMMARY ***");
+            continue;
+        }
+        // Player's lines, like 'name: raises $10 to $20 and is all-in'
+        for (const string& s : seats) {
+            if (l.compare(0, s.size(), s) || l.compare(s.size(), 2, ": "))
+                continue;
+
+            string verb = l.substr(s.size() + 2);
+            if (!verb.compare(0, 6, "shows ") || !verb.compare(0, 5, "folds"))
+                if (verb.find('[') != string::npos)
+                    known.emplace_back(s, history_cards(verb));
+
+            for (const string& act : Actions)
+                if (!over && !verb.compare(0, act.size(), act)) {
+                    bool shove = verb.find("is all-in") != string::npos;
+                    acted.push_back(s);
+                    if (act == "folds")
+                        folded.push_back(s);
+                    if (act != "checks" && act != "posts")
+                        lastAction = current;
+                    if (act == "calls" && (allIn || shove))
+                        called = current;
+                    allIn |= shove;
+                }
+            break;
+        }
+    }
+    if (called == -1 || lastAction > called)
+        return false;
+
+    auto has = [](const vector<string>& v, const string& s) {
+        return std::find(v.begin(), v.end(), s) != v.end();
+    };
+
+    a.street = called;
+    a.board = boards[called];
+    a.dead = 0;
+    a.names.clear();
+    a.holes.clear();
+
+    for (const string& s : seats) {
+        uint64_t cards = 0;
+        for (const auto& k : known)
+            if (k.first == s)
+                cards = k.second;
+
+        if (has(folded, s))
+            a.dead |= cards;
+
+        else if (has(acted, s)) {
+            if (popcount(cards) != 2)
+                return false;
+            a.names.push_back(s);
+            a.holes.push_back(cards);
+        }
+    }
+    return a.names.size() >= 2;
+}
+
+// Play the all-ins of a batch, exact when there are at most as many runouts as
+// Monte Carlo games, and print the equities in the order of the history.
+void play_allins(const vector<AllIn>& allIns, Args& args)
+{
+    const char* names[] = { "Preflop", "Flop", "Turn", "River" };
+    vector<const AllIn*> played;
+    Batch batch;
+    Outputs out;
+    out.batch = &batch;
+
+    for (const AllIn& a : allIns) {
+        string pos;
+        for (uint64_t h : a.holes) {
+            string hole = board_string(h);
+            hole.erase(remove(hole.begin(), hole.end(), ' '), hole.end());
+            pos += hole + " ";
+        }
+        pos += "- " + board_string(a.board);
+
+        Spot s(int(a.holes.size()), pos);
+        if (!s.valid() || !s.set_dead(a.dead)) {
+            cerr << "Error in hand #" << a.id << ": " << pos << endl;
+            continue;
+        }
+        size_t r = s.runouts();
+        batch.spots.push_back(s);
+        batch.games.push_back(r && r <= args.gamesNum ? 0 : args.gamesNum);
+        played.push_back(&a);
+    }
+    if (played.empty())
+        return;
+
+    run(0, 0, args.threadsNum, SPOTS, args.results, out, Shard(), args.binding);
+
+    for (size_t k = 0; k < played.size(); ++k) {
+        const AllIn& a = *played[k];
+        const Result* r = &batch.results[k * PLAYERS_NB];
+        string board = board_string(a.board);
+        uint64_t games = 0;
+
+        for (size_t p = 0; p < a.holes.size(); ++p)
+            games += KTie * r[p].first + r[p].second;
+
+        cout << "#" << a.id << " " << names[a.street] << " ["
+             << board.substr(0, board.size() - !board.empty()) << "]:"
+             << fixed << setprecision(2);
+
+        for (size_t p = 0; p < a.holes.size(); ++p)
+            cout << (p ? ", " : " ") << a.names[p] << " " << board_string(a.holes[p])
+                 << (KTie * r[p].first + r[p].second) * 100.0 / games << "%";
+
+        cout << (batch.games[k] ? " (Monte Carlo)" : " (exact)") << "\n";
+    }
+}
+
+// histories() computes the equity of every all-in of a PokerStars hand history
+// file, like 'histories hands.txt -t 8 -g 10K'. Records are streamed, and the
+// all-ins are played in batches, each one by a single thread of the pool. The
+// games are the Monte Carlo ones of the all-ins with more runouts, default 5K.
+void histories(istringstream& is, Args& args)
+{
+    constexpr size_t BatchSize = 4096;
+    string file, line, options;
+    vector<string> record;
+    vector<AllIn> allIns;
+    AllIn a;
+    size_t hands = 0, found = 0;
+
+    is >> file;
+    getline(is, options);
+    istringstream os(options);
+    parse_args(os, args);
+    if (options.find("-g") == string::npos)
+        args.gamesNum = 5000;
+
+    ifstream f(file);
+    if (!f) {
+        cerr << "Cannot read hand history file: " << file << endl;
+        return;
+    }
+    TimePoint elapsed = now();
+
+    // A record begins with the hand's header, the last one ends at EOF
+    while (true) {
+        bool eof = !getline(f, line);
+
+        if (!line.compare(0, 3, "\xEF\xBB\xBF")) // UTF-8 byte order mark
+            line.erase(0, 3);
+        if (line.size() && line.back() == '\r')
+            line.pop_back();
+
+        if (eof || !line.compare(0, 10, "PokerStars")) {
+            if (record.size()) {
+                hands++;
+                if (parse_history(record, a))
+                    allIns.push_back(a);
+            }
+            record.clear();
+        }
+        if (eof || allIns.size() == BatchSize) {
+            play_allins(allIns, args);
+            found += allIns.size();
+            allIns.clear();
+        }
+        if (eof)
+            break;
+        if (line.size())
+            record.push_back(line);
+    }
+    elapsed = now() - elapsed + 1;
+
+    cerr << "\nHands: " << hands << ", all-ins: " << found << ", time: " << elapsed
+         << " ms, hands/second: " << 1000 * hands / elapsed << endl;
+}
+
+// position() starts a session with the options and the position of go, like
+// 'position -p 3 -t 4 AhKh [QQ+,AK] - 2c 7d 9s'.
+void position(istringstream& is)
+{
+    Args& args = Live.args;
+    string token;
+
+    parse_args(is, args);
+
+    // Position is like 'AhKh [QQ+,AK] - 2c7d9s ', split holes and board
+    istringstream ss(args.pos);
+    Live.holes.clear();
+    while (ss >> token && token != "-")
+        Live.holes.push_back(token);
+
+    Live.board = parse_board(ss);
+    Live.players = args.players;
+    if (!Live.board && args.commons.size()) {
+        cerr << "Error in board: " << args.commons << endl;
+        Live.players = 0;
+        return;
+    }
+    session_update(true);
+}
+
+// session() handles 'board add Xx' and 'fold N' on the current session, where
+// N is the player number in the last results.
+void session(const string& cmd, istringstream& is)
+{
+    string token;
+    int n = 0;
+
+    if (!Live.players) {
+        cerr << "No position, start with: position ..." << endl;
+        return;
+    }
+
+    if (cmd == "board" && is >> token && token == "add") {
+        uint64_t b = parse_board(is);
+        if (!b || (b & Live.board) || popcount(Live.board | b) > 5) {
+            cerr << "Wrong cards to add to: " << board_string(Live.board) << endl;
+            return;
+        }
+        Live.board |= b;
+        session_update(false);
+    }
+    else if (cmd == "fold" && is >> n && n >= 1 && n <= Live.players && Live.players > 2) {
+        // Players without a hole token are random, just drop one of them
+        if (n <= int(Live.holes.size()))
+            Live.holes.erase(Live.holes.begin() + n - 1);
+        Live.players--;
+        session_update(true);
+    }
+    else
+        cerr << "Usage: board add Xx [Yy..] | fold N" << endl;
+}
+
+constexpr uint64_t GoodSig[DECK_NB] = { 9886574903307142480ULL, 13657202139776393712ULL };
+
+// Run the bench positions with the given options, return the elapsed time
+TimePoint bench_positions(const string& options, Hash& sig, uint64_t& cards,
+                          uint64_t& spots, bool verbose)
+{
+    Args args;
+    uint64_t cnt = 0;
+
+    TimePoint elapsed = now();
+
+    for (const string& pos : BenchPos[Deck::Index]) {
+        if (verbose)
+            cerr << "\nPosition " << ++cnt << ": " << pos << endl;
+        istringstream ss(options + pos);
+        go(ss, args);
+
+        for (int p = 0; p < args.players; ++p)
+            sig << args.results[p].first + args.results[p].second;
+
+        cards += args.gamesNum * (args.players * 2 + 5);
+        spots += args.gamesNum;
+    }
+
+    return now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+}
+
+// Run the bench positions with each evaluator backend, muted, and report their
+// speed and memory. Results are cross-checked by the signatures.
+void bench_evals(const string& options)
+{
+    const char* names[] = { "bitboard", "table" };
+    streambuf* buf = cout.rdbuf();
+    ostringstream sink;
+    uint64_t sigs[2];
+
+    cerr << "\nEvaluator   Time (ms)   Games/second   Memory (KB)   Signature\n";
+
+    for (int e = 0; e < 2; ++e) {
+        Hash sig;
+        uint64_t cards = 0, spots = 0;
+
+        cout.rdbuf(sink.rdbuf()); // Mute results
+        TimePoint elapsed = bench_positions(options + "--eval " + names[e] + " ",
+                                            sig, cards, spots, false);
+        cout.rdbuf(buf);
+        sink.str("");
+
+        size_t mem = e ? TableEval::memory() : BitboardEval::memory();
+        sigs[e] = sig.get();
+        cerr << left << setw(9) << names[e] << right << setw(12) << elapsed
+             << setw(15) << 1000 * spots / elapsed << setw(14) << mem / 1024
+             << (sigs[e] == GoodSig[Deck::Index] ? "   OK" : "   FAIL") << endl;
+    }
+    cerr << "\nResults are " << (sigs[0] == sigs[1] ? "identical" : "different") << endl;
+}
+
+// Run the bench positions, muted, without and with the hand categories, that
+// score all the hands at showdown, and report the overhead. Equities must not
+// change, so the signatures are the same.
+void bench_categories(const string& options)
+{
+    const char* names[] = { "off", "on" };
+    streambuf* buf = cout.rdbuf();
+    ostringstream sink;
+    uint64_t sigs[2];
+    TimePoint times[2];
+
+    cerr << "\nCategories   Time (ms)   Games/second   Signature\n";
+
+    for (int e = 0; e < 2; ++e) {
+        Hash sig;
+        uint64_t cards = 0, spots = 0;
+
+        cout.rdbuf(sink.rdbuf()); // Mute results
+        times[e] = bench_positions(options + (e ? "-c " : ""), sig, cards, spots, false);
+        cout.rdbuf(buf);
+        sink.str("");
+
+        sigs[e] = sig.get();
+        cerr << left << setw(10) << names[e] << right << setw(12) << times[e]
+             << setw(15) << 1000 * spots / times[e]
+             << (sigs[e] == GoodSig[Deck::Index] ? "   OK" : "   FAIL") << endl;
+    }
+    cerr << "\nResults are " << (sigs[0] == sigs[1] ? "identical" : "different")
+         << ", overhead " << fixed << setprecision(1)
+         << 100.0 * (times[1] - times[0]) / times[0] << "%" << endl;
+}
+
+// Run each bench position, muted, with single games and then with k games
+// interleaved, and report per position the speed and the instructions per
+// cycle, when the hardware counters are available, and the gain in speed.
+void bench_interleave(const string& options, unsigned k)
+{
+    const vector<string>& positions = BenchPos[Deck::Index];
+    streambuf* buf = cout.rdbuf();
+    ostringstream sink;
+    Hash sigs[2];
+    TimePoint total[2] = {};
+    Args args;
+
+    cerr << "\nPosition   Games/second    IPC   Interleaved " << k << "    IPC    Gain\n";
+
+    for (size_t n = 0; n < positions.size(); ++n) {
+        double speed[2], ipc[2];
+
+        for (int e = 0; e < 2; ++e) {
+            PerfCounters pc;
+            uint64_t cycles, instructions;
+            istringstream ss(options + (e ? "--interleave " + to_string(k) + " " : "")
+                             + positions[n]);
+
+            bool counted = pc.start();
+            cout.rdbuf(sink.rdbuf()); // Mute results
+            TimePoint elapsed = now();
+            go(ss, args);
+            elapsed = now() - elapsed + 1;
+            cout.rdbuf(buf);
+            sink.str("");
+            counted &= pc.stop(cycles, instructions);
+
+            for (int p = 0; p < args.players; ++p)
+                sigs[e] << args.results[p].first + args.results[p].second;
+
+            total[e] += elapsed;
+            speed[e] = 1000.0 * args.gamesNum / elapsed;
+            ipc[e] = counted && cycles ? double(instructions) / cycles : 0;
+        }
+        cerr << setw(8) << n + 1 << setw(15) << uint64_t(speed[0]) << fixed << setprecision(2);
+        ipc[0] ? cerr << setw(7) << ipc[0] : cerr << setw(7) << "n/a";
+        cerr << setw(18) << uint64_t(speed[1]);
+        ipc[1] ? cerr << setw(7) << ipc[1] : cerr << setw(7) << "n/a";
+        cerr << setw(7) << speed[1] / speed[0] << "x" << endl;
+    }
+    cerr << "\nTotal time " << total[0] << " ms, interleaved " << total[1] << " ms, gain "
+         << fixed << setprecision(2) << double(total[0]) / total[1] << "x"
+         << "\nResults are " << (sigs[0].get() == sigs[1].get() ? "identical" : "different")
+         << (sigs[1].get() == GoodSig[Deck::Index] ? " (OK)" : " (FAIL)") << endl;
+}
+
+// bench() runs a benchmark for speed and signature, optionally with the number
+// of threads, a binding policy and the evaluator: bitboard, table or both, to
+// compare them side by side. With 'categories' it measures the overhead of the
+// hand categories instead, and with 'interleave [k]' the gain of playing k games
+// together, 4 by default.
+void bench(istringstream& is)
+{
+    string token, eval = "bitboard";
+    bool categories = false;
+    unsigned interleave = 0;
+    Hash sig;
+    uint64_t cards = 0, spots = 0;
+    string options = "-t 1 ";
+
+    while (is >> token)
+        if (token == "bitboard" || token == "table" || token == "both")
+            eval = token;
+        else if (token == "categories")
+            categories = true;
+        else if (token == "interleave")
+            interleave = is >> interleave ? interleave : 4;
+        else if (isdigit(token[0]) || token == "auto")
+            options = "-t " + token + " ";
+        else
+            options += "--bind " + token + " ";
+
+    if (interleave) {
+        bench_interleave(options + "--eval " + (eval == "both" ? "bitboard" : eval) + " ",
+                         std::min(std::max(interleave, 2U), unsigned(MAX_INTERLEAVE)));
+        return;
+    }
+    if (categories) {
+        bench_categories(options + "--eval " + (eval == "both" ? "bitboard" : eval) + " ");
+        return;
+    }
+    if (eval == "both") {
+        bench_evals(options);
+        return;
+    }
+    TimePoint elapsed = bench_positions(options + "--eval " + eval + " ", sig, cards, spots, true);
+
+    cerr << "\n==========================="
+         << "\nTotal time   : " << elapsed << " msec"
+         << "\nSpots played : " << spots / 1000000 << "M"
+         << "\nCards/second : " << 1000 * cards / elapsed
+         << "\nGames/second : " << 1000 * spots / elapsed
+         << "\nSignature    : " << sig.get();
+
+    cerr << (sig.get() == GoodSig[Deck::Index] ? " (OK)" : " (FAIL)");
+
+    cerr << endl;
+}
+
+// Score all the 5 cards hands of deck D, count them by category and check the
+// counts against the expected ones, and that the scores of the categories do
+// not overlap and follow the given order, from the weakest.
+template<typename D>
+bool verify_deck(uint64_t count[], const uint64_t expected[], const HandCategory order[])
+{
+    uint64_t lo[CATEGORY_NB], hi[CATEGORY_NB] = {};
+    vector<unsigned> cards, idx = { 0, 1, 2, 3, 4 };
+    bool ok = true;
+
+    std::fill(lo, lo + CATEGORY_NB, ~0ULL);
+    std::fill(count, count + CATEGORY_NB, 0);
+
+    for (unsigned c = 0; c < 64; ++c)
+        if (!(D::Absent & (1ULL << c)))
+            cards.push_back(c);
+
+    while (true) {
+        Hand h = Hand();
+        h.suits = SuitInit;
+        for (unsigned i : idx)
+            h.add(Card(cards[i]), 0);
+        h.do_score<D>();
+
+        HandCategory c = category<D>(h.score);
+        count[c]++;
+        lo[c] = std::min(lo[c], h.score);
+        hi[c] = std::max(hi[c], h.score);
+
+        int i = 4;
+        while (i >= 0 && idx[i] == cards.size() - 5 + i)
+            --i;
+        if (i < 0)
+            break;
+        ++idx[i];
+        for (int j = i + 1; j < 5; ++j)
+            idx[j] = idx[j - 1] + 1;
+    }
+
+    for (int c = 0; c < CATEGORY_NB; ++c)
+        ok &=   count[c] == expected[c]
+            && (c == 0 || hi[order[c - 1]] < lo[order[c]]);
+    return ok;
+}
+
+// verify() checks the scorer of each deck on all the 5 cards hands
+void verify()
+{
+    const char* names[] = { "High card", "Pair", "Two pair", "Trips", "Straight",
+                            "Flush", "Full house", "Quads", "Straight flush" };
+
+    const uint64_t full[] = { 1302540, 1098240, 123552, 54912, 10200, 5108, 3744, 624, 40 };
+    const uint64_t shrt[] = { 122400, 193536, 36288, 16128, 6120, 480, 1728, 288, 24 };
+
+    const HandCategory fullOrder[] = { HIGH_CARD, PAIR, TWO_PAIR, TRIPS, STRAIGHT,
+                                       FLUSH, FULL_HOUSE, QUADS, STRAIGHT_FLUSH };
+    const HandCategory shrtOrder[] = { HIGH_CARD, PAIR, TWO_PAIR, TRIPS, STRAIGHT,
+                                       FULL_HOUSE, FLUSH, QUADS, STRAIGHT_FLUSH };
+
+    uint64_t cnt[DECK_NB][CATEGORY_NB];
+    bool ok[] = { verify_deck<FullDeck>(cnt[0], full, fullOrder),
+                  verify_deck<ShortDeck>(cnt[1], shrt, shrtOrder) };
+
+    cerr << "\nCategory          Full deck   Short deck\n";
+
+    for (int c = 0; c < CATEGORY_NB; ++c)
+        cerr << left << setw(16) << names[c] << right << setw(11) << cnt[0][c]
+             << setw(13) << cnt[1][c] << endl;
+
+    cerr << "\nFull deck: " << (ok[0] ? "OK" : "FAIL")
+         << ", short deck: " << (ok[1] ? "OK" : "FAIL") << endl;
+}
+
+// omahabench() times the Omaha hand scoring on random 6-handed deals: scoring
+// the 60 hands of each player from scratch, sharing the board's triples and
+// pruning by the best score so far, and pruning by the showdown's floor too.
+// Scores are checked against the naive ones.
+void omahabench(istringstream& is)
+{
+    const unsigned Players = 6;
+    size_t deals = 200000;
+    string token;
+
+    if (is >> token)
+        deals = parse_games(token);
+
+    vector<uint64_t> commons(deals), holes(deals * Players);
+    PRNG prng(0);
+
+    for (size_t d = 0; d < deals; ++d) {
+        uint64_t all = 0;
+        auto deal = [&](unsigned n) {
+            uint64_t b = 0;
+            while (popcount(b) < int(n)) {
+                unsigned c = prng.next() & 0x3F;
+                if (in_deck(c) && !((all | b) & (1ULL << c)))
+                    b |= 1ULL << c;
+            }
+            return all |= b, b;
+        };
+        commons[d] = deal(5);
+        for (unsigned p = 0; p < Players; ++p)
+            holes[d * Players + p] = deal(OMAHA_HOLE_NB);
+    }
+
+    // Check the scores of each player first, out of the timed loops
+    size_t mismatches = 0;
+    for (size_t d = 0; d < deals; ++d) {
+        OmahaBoard b;
+        b.set(commons[d]);
+        for (unsigned p = 0; p < Players; ++p)
+            mismatches +=  omaha_score(b, holes[d * Players + p])
+                        != omaha_score_naive(commons[d], holes[d * Players + p]);
+    }
+
+    // Best score of each deal, with the 3 scorers
+    vector<uint64_t> best[3] = { vector<uint64_t>(deals), vector<uint64_t>(deals),
+                                 vector<uint64_t>(deals) };
+    TimePoint elapsed[3];
+
+    for (int s = 0; s < 3; ++s) {
+        TimePoint t0 = now();
+        for (size_t d = 0; d < deals; ++d) {
+            OmahaBoard b;
+            uint64_t& m = best[s][d];
+            if (s)
+                b.set(commons[d]);
+
+            for (unsigned p = 0; p < Players; ++p) {
+                uint64_t h = holes[d * Players + p];
+                uint64_t sc = s == 0 ? omaha_score_naive(commons[d], h)
+                            : s == 1 ? omaha_score(b, h) : omaha_score(b, h, m);
+                m = std::max(m, sc);
+            }
+        }
+        elapsed[s] = std::max(now() - t0, TimePoint(1));
+    }
+    for (size_t d = 0; d < deals; ++d)
+        mismatches += best[1][d] != best[0][d] || best[2][d] != best[0][d];
+
+    const char* names[] = { "Naive", "Shared board", "Showdown floor" };
+
+    cerr << "\nScorer            Time (ms)   Hands/second   Speedup\n";
+
+    for (int s = 0; s < 3; ++s)
+        cerr << left << setw(16) << names[s] << right << setw(11) << elapsed[s]
+             << setw(15) << 1000 * deals * Players / elapsed[s]
+             << setw(9) << fixed << setprecision(2)
+             << double(elapsed[0]) / elapsed[s] << "x" << endl;
+
+    cerr << "\nDeals: " << deals << " with " << Players << " players, mismatches: "
+         << mismatches << (mismatches ? " (FAIL)" : " (OK)") << endl;
+}
+
+// range() defines a named range, referenced later as @name in range tokens,
+// like 'range 3bet [QQ+,AKs,A5s-A4s]'.
+void range(istringstream& is)
+{
+    string name, token;
+
+    is >> name >> token;
+    int n = define_range(name, token);
+
+    if (n < 0)
+        cerr << "Error in range: " << name << " " << token << endl;
+    else
+        cout << "Range @" << name << " of size: " << n << endl;
+}
+
+// latency() runs a go query many times, with output muted, and reports the
+// percentiles of the time spent in each phase. Spots are cached, so after the
+// first query spot time is just a lookup.
+void latency(istringstream& is, Args& args)
+{
+    const char* names[] = { "Parse", "Spot", "Run", "Output", "Total" };
+    size_t n = 0;
+    string query;
+
+    if (!(is >> n) || !n || !getline(is, query)) {
+        cerr << "Usage: latency N query" << endl;
+        return;
+    }
+    vector<TimePoint> samples[PHASE_NB + 1];
+    streambuf* buf = cout.rdbuf();
+    ostringstream sink;
+    istringstream ss;
+
+    for (size_t i = 0; i < n; ++i) {
+        cout.rdbuf(sink.rdbuf()); // Mute results
+        ss.clear();
+        ss.str(query);
+        go(ss, args);
+        cout.rdbuf(buf);
+        sink.str("");
+
+        TimePoint total = 0;
+        for (int p = 0; p < PHASE_NB; ++p) {
+            samples[p].push_back(args.phases[p]);
+            total += args.phases[p];
+        }
+        samples[PHASE_NB].push_back(total);
+    }
+
+    cout << "\nLatency of " << n << " queries (us)\n"
+         << "            p50      p90      p99      max\n";
+
+    for (int p = 0; p <= PHASE_NB; ++p) {
+        vector<TimePoint>& v = samples[p];
+        sort(v.begin(), v.end());
+        cout << setw(6) << names[p];
+        for (double q : { 0.5, 0.9, 0.99, 1.0 })
+            cout << setw(9) << v[min(size_t(q * n), n - 1)];
+        cout << endl;
+    }
+}
+
+// scaling() runs the bench positions with 1, 2, 4... up to the given number of
+// threads, default to all the logical CPUs, and an optional binding policy.
+// Results of each run are not printed, just speed and signature.
+void scaling(istringstream& is)
+{
+    string token, binding;
+    size_t maxThreads = std::max(thread::hardware_concurrency(), 1U);
+
+    if (is >> token)
+        maxThreads = token == "auto" ? physical_cores() : stoi(token);
+
+    if (is >> binding)
+        binding = "--bind " + binding + " ";
+
+    cerr << "\nThreads   Time (ms)   Games/second   Speedup   Efficiency   Signature\n";
+
+    TimePoint base = 0;
+    streambuf* buf = cout.rdbuf();
+    ostringstream sink;
+
+    for (size_t t = 1; t <= maxThreads; t = (t * 2 > maxThreads && t < maxThreads ? maxThreads : t * 2)) {
+        Hash sig;
+        uint64_t cards = 0, spots = 0;
+
+        cout.rdbuf(sink.rdbuf()); // Mute results
+        TimePoint elapsed = bench_positions("-t " + to_string(t) + " " + binding,
+                                            sig, cards, spots, false);
+        cout.rdbuf(buf);
+        sink.str("");
+
+        if (t == 1)
+            base = elapsed;
+
+        double speedup = double(base) / elapsed;
+        cerr << setw(7) << t << setw(12) << elapsed << setw(15) << 1000 * spots / elapsed
+             << setw(9) << fixed << setprecision(2) << speedup << "x"
+             << setw(12) << setprecision(0) << 100 * speedup / t << "%"
+             << (sig.get() == GoodSig[Deck::Index] ? "   OK" : "   FAIL") << endl;
+    }
 }
 
 } // namespace
@@ -196,8 +2114,38 @@ int main(int argc, char* argv[])
             break;
         else if (token == "go")
             go(is, args);
+        else if (token == "matrix")
+            matrix(is, args);
+        else if (token == "compare")
+            compare(is, args);
+        else if (token == "merge")
+            merge(is);
+        else if (token == "verify")
+            verify();
+        else if (token == "omahabench")
+            omahabench(is);
         else if (token == "bench")
             bench(is);
+        else if (token == "scaling")
+            scaling(is);
+        else if (token == "latency")
+            latency(is, args);
+        else if (token == "range")
+            range(is);
+        else if (token == "preflop")
+            preflop(is, args);
+        else if (token == "outs")
+            outs(is, args);
+        else if (token == "flopsweep")
+            flopsweep(is, args);
+        else if (token == "ehs")
+            ehs(is, args);
+        else if (token == "histories")
+            histories(is, args);
+        else if (token == "position")
+            position(is);
+        else if (token == "board" || token == "fold")
+            session(token, is);
         else
             cout << "Unknown command: " << cmd << endl;
 
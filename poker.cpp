@@ -3,7 +3,7 @@
 #include <cstring>
 #include <ctype.h>
 #include <iostream>
-#include <set>
+#include <map>
 #include <sstream>
 #include <string>
 
@@ -17,11 +17,81 @@ const string Values = "23456789TJQKA";
 const string Suites = "dhcs";
 const string SO = "so";
 
-// Needed by std::set, not to compare scores!
-auto key_compare = [](const Hand& h1, const Hand& h2) {
-    return h1.cards < h2.cards;
+constexpr int COMBOS_NB = 1326;
+
+/// A set of the 1326 possible combos of 2 hole cards, one bit per combo. Set
+/// operations work a whole array of 64 bit words at a time, rounded up to a
+/// multiple of 256 bits, so the compiler vectorizes them with SIMD registers.
+struct ComboSet {
+
+    uint64_t b[24];
+
+    void clear() { std::fill(b, b + 24, 0); }
+    void set(int idx) { b[idx / 64] |= 1ULL << (idx % 64); }
+    bool test(int idx) const { return b[idx / 64] & (1ULL << (idx % 64)); }
+
+    ComboSet& operator|=(const ComboSet& s) {
+        for (int i = 0; i < 24; ++i) b[i] |= s.b[i];
+        return *this;
+    }
+    ComboSet& operator&=(const ComboSet& s) {
+        for (int i = 0; i < 24; ++i) b[i] &= s.b[i];
+        return *this;
+    }
+    ComboSet& operator-=(const ComboSet& s) {
+        for (int i = 0; i < 24; ++i) b[i] &= ~s.b[i];
+        return *this;
+    }
+    int count() const {
+        int n = 0;
+        for (int i = 0; i < 24; ++i) n += popcount(b[i]);
+        return n;
+    }
 };
-typedef std::set<Hand, decltype(key_compare)> HandSet;
+
+/// Combo indices follow the order of the combos' bitboards, so iterating a
+/// ComboSet yields the combos sorted by cards, as the std::set it replaces.
+struct ComboTable {
+
+    Hand hands[COMBOS_NB];
+    uint16_t index[64][64];  // Index of the combo of cards c1 and c2
+    ComboSet withCard[64];   // Combos containing a given card
+
+    ComboTable() {
+        vector<uint64_t> all;
+        for (int c1 = 0; c1 < 64; ++c1)
+            for (int c2 = c1 + 1; c2 < 64; ++c2)
+                if (c1 % 16 < int(INVALID) && c2 % 16 < int(INVALID))
+                    all.push_back((1ULL << c1) | (1ULL << c2));
+
+        std::sort(all.begin(), all.end());
+        for (ComboSet& s : withCard)
+            s.clear();
+
+        for (int i = 0; i < COMBOS_NB; ++i) {
+            uint64_t b = all[i];
+            int c1 = pop_lsb(&b), c2 = pop_lsb(&b);
+            hands[i] = Hand();
+            hands[i].add(Card(c1), 0);
+            hands[i].add(Card(c2), 0);
+            index[c1][c2] = index[c2][c1] = uint16_t(i);
+            withCard[c1].set(i);
+            withCard[c2].set(i);
+        }
+    }
+} Combos;
+
+/// Ranges defined with the range command, referenced as @name
+map<string, ComboSet> NamedRanges;
+unsigned RangesGeneration; // Bumped on every (re)definition
+
+/// Intern cache of the range tokens already parsed, with the corresponding
+/// Range built on first use by a Spot. Cleared when a named range changes.
+struct Interned {
+    ComboSet set;
+    std::shared_ptr<const Range> range;
+};
+map<string, Interned> InternCache;
 
 // Parse a string token with one or more consecutive cards into a Hand
 bool parse_cards(const string& token, Hand& h, Hand& all, unsigned max)
@@ -40,7 +110,7 @@ bool parse_cards(const string& token, Hand& h, Hand& all, unsigned max)
 
         Card card = Card(16 * c + v);
 
-        if (!all.add(card, 0)) // Double card
+        if (!all.add(card, Deck::Absent)) // Double card or not in the deck
             return false;
 
         if (!h.add(card, 0)) {
@@ -53,7 +123,7 @@ bool parse_cards(const string& token, Hand& h, Hand& all, unsigned max)
 
 // Expand tokens like T6s+, 88+, 52o+, AA, AK, QQ-99, T7s-T3s, J8-52 in the
 // group of corresponding pair of cards (combos).
-bool expand(const string& token, HandSet& ranges)
+bool expand(const string& token, ComboSet& ranges)
 {
     enum SuitFilter { AnySuit, Suited, Offsuited };
 
@@ -115,11 +185,9 @@ bool expand(const string& token, HandSet& ranges)
                     || (f == Offsuited && c1 == c2))
                     continue;
 
-                Hand h = Hand(), all = Hand();
-                string card = Values[v1] + string(1, c1) + Values[v2] + string(1, c2);
-                if (!parse_cards(card, h, all, 2))
-                    return false;
-                ranges.insert(h); // Insert if not already exsisting
+                int i1 = 16 * int(Suites.find(c1)) + int(v1);
+                int i2 = 16 * int(Suites.find(c2)) + int(v2);
+                ranges.set(Combos.index[i1][i2]);
             }
 
         if (range && v2 > v4) {
@@ -139,47 +207,229 @@ bool expand(const string& token, HandSet& ranges)
     return true;
 }
 
-} // namespace
+// The 24 permutations of the 4 suits, SuitPerms[0] is the identity
+struct SuitPermsTable {
+    unsigned p[24][4];
+    SuitPermsTable() {
+        unsigned s[] = { 0, 1, 2, 3 };
+        for (int i = 0; i < 24; std::next_permutation(s, s + 4), ++i)
+            std::copy(s, s + 4, p[i]);
+    }
+} SuitPerms;
+
+// Apply a suit permutation to a bitboard of cards
+uint64_t permute(uint64_t b, int perm)
+{
+    uint64_t r = 0;
+    for (int s = 0; s < 4; ++s)
+        r |= ((b >> (16 * s)) & 0xFFFF) << (16 * SuitPerms.p[perm][s]);
+    return r;
+}
+
+// Build a Hand out of a bitboard of cards
+Hand make_hand(uint64_t b)
+{
+    Hand h = Hand();
+    h.suits = SuitInit;
+    while (b)
+        h.add(Card(pop_lsb(&b)), 0);
+    return h;
+}
+
+// Parse a single term of a range expression: a group like 'T6s+' or 'QQ-99',
+// a specific combo like 'AhKd', a named range like '@open', or '*' followed by
+// some cards, like '*Ac7d2s', for all the combos blocked by any of them.
+bool expand_term(const string& term, ComboSet& set)
+{
+    set.clear();
+
+    if (term.size() > 1 && term[0] == '@') {
+        auto it = NamedRanges.find(term.substr(1));
+        if (it == NamedRanges.end())
+            return false;
+        set = it->second;
+        return true;
+    }
+    if (term.size() > 1 && term[0] == '*') {
+        Hand h = Hand(), all = Hand();
+        if (!parse_cards(term.substr(1), h, all, 52))
+            return false;
+        for (uint64_t b = h.cards; b; )
+            set |= Combos.withCard[pop_lsb(&b)];
+        return true;
+    }
+    if (   term.size() == 4
+        && Suites.find(term[1]) != string::npos
+        && Suites.find(term[3]) != string::npos) {
+        Hand h = Hand(), all = Hand();
+        if (!parse_cards(term, h, all, 2))
+            return false;
+        uint64_t b = h.cards;
+        int c1 = pop_lsb(&b), c2 = pop_lsb(&b);
+        set.set(Combos.index[c1][c2]);
+        return true;
+    }
+    return expand(term, set);
+}
 
 // Parse a string token with a list of ranges like '[AK,88+,76s+]' or a single
-// one like 'QQ+' into a set of hands, each one of 2 hole cards.
-bool Spot::parse_range(const string& token, int player)
+// one like 'QQ+' into a set of combos, each one of 2 hole cards. Terms can be
+// combined also with '&' (intersection) and '~' (subtraction), evaluated left
+// to right, like '[@3bet~*Ac7d2s]' or '[@open&@call]'.
+bool expand_range(const string& token, ComboSet& set)
 {
     bool hasBrackets = (token.front() == '[' && token.back() == ']');
     bool isList = (token.find(",") != string::npos);
     if (!hasBrackets && isList)
         return false;
 
-    string combo;
-    HandSet handSet(key_compare); // Use a set to avoid duplicates
-    size_t cnt = 0;
-    stringstream ss(hasBrackets ? token.substr(1, token.size() - 2) : token);
+    auto it = InternCache.find(token);
+    if (it != InternCache.end()) {
+        set = it->second.set;
+        return true;
+    }
+
+    string body = hasBrackets ? token.substr(1, token.size() - 2) : token;
+    ComboSet term;
+    char op = ',';
+    size_t i = 0;
 
-    while (std::getline(ss, combo, ','))
-        if (!expand(combo, handSet))
+    set.clear();
+
+    while (true) {
+        size_t j = std::min(body.find_first_of(",&~", i), body.size());
+
+        if (!expand_term(body.substr(i, j - i), term))
             return false;
 
-    if (handSet.empty() || handSet.size() > MAX_RANGE)
+        if (op == ',')
+            set |= term;
+        else if (op == '&')
+            set &= term;
+        else
+            set -= term;
+
+        if (j == body.size())
+            break;
+
+        op = body[j];
+        i = j + 1;
+    }
+
+    if (!set.count())
+        return false;
+
+    if (InternCache.size() > 4096)
+        InternCache.clear();
+
+    InternCache[token].set = set;
+    return true;
+}
+
+// Combos of a set in the deck, in order of their cards
+vector<Hand> combo_list(const ComboSet& set)
+{
+    vector<Hand> combos;
+    for (int i = 0; i < COMBOS_NB; ++i)
+        if (set.test(i) && !(Combos.hands[i].cards & Deck::Absent))
+            combos.push_back(Combos.hands[i]);
+    return combos;
+}
+
+} // namespace
+
+/// Parse a range token into the list of its distinct combos
+bool parse_combos(const string& token, vector<Hand>& combos)
+{
+    ComboSet set;
+
+    if (!expand_range(token, set))
         return false;
 
-    // Duplicate the handset into multiple full copies in combos[]. We will pick
-    // randomly from there at simulation time.
-    for (size_t i = 0; i < MAX_RANGE / handSet.size(); ++i)
-        for (const Hand& h : handSet)
-            combos[player][cnt++] = h;
+    combos = combo_list(set);
+    return !combos.empty();
+}
+
+/// Define or redefine a named range, to be referenced as @name in the range
+/// tokens. Return the number of its combos, or -1 on a wrong token.
+int define_range(const string& name, const string& token)
+{
+    ComboSet set;
+
+    if (name.empty() || !expand_range(token, set))
+        return -1;
+
+    NamedRanges[name] = set;
+    InternCache.clear(); // Cached tokens could refer to the old definition
+    RangesGeneration++;
+    return set.count();
+}
+
+/// Generation of the named ranges, so that callers caching parsed spots can
+/// tell when a range they may refer to has been redefined.
+unsigned ranges_generation() { return RangesGeneration; }
+
+Range::Range(const vector<Hand>& hands, const string& tk) : size(hands.size()), token(tk)
+{
+    constexpr size_t LineSize = 64;
+
+    // Entries of each array, sentinel included, rounded up to a whole cache
+    // line of uint64_t, and some slack to align the start of the block.
+    size_t n = (size + 1 + 7) / 8 * 8;
+    mem = static_cast<char*>(malloc(n * (8 + 8 + 4) + LineSize));
+
+    char* p = mem + (LineSize - uintptr_t(mem) % LineSize) % LineSize;
+    uint64_t* sc = reinterpret_cast<uint64_t*>(p);
+    uint64_t* cd = sc + n;
+    uint32_t* su = reinterpret_cast<uint32_t*>(cd + n);
+
+    for (size_t i = 0; i < size; ++i)
+        sc[i] = hands[i].score, cd[i] = hands[i].cards, su[i] = hands[i].suits;
+
+    sc[size] = su[size] = 0;
+    cd[size] = COMBO_EOF;
+    scores = sc, cards = cd, suits = su;
+
+    size_t copies = MAX_RANGE / size;
+    for (size_t j = 0; j < MAX_RANGE; ++j)
+        pick[j] = uint16_t(j < copies * size ? j % size : size);
+}
+
+// Parse a range token and store it for the given player
+bool Spot::parse_range(const string& token, int player)
+{
+    ComboSet set;
 
-    // Fill remaining entries with COMBO_EOF
-    Hand invalid = Hand();
-    invalid.cards = COMBO_EOF;
-    while (cnt < MAX_RANGE)
-        combos[player][cnt++] = invalid;
+    if (!expand_range(token, set))
+        return false;
 
-    cout << "Set range " << token << " for player " << player + 1
-         << " of size: " << handSet.size() << endl;
+    // Ranges are built once per token and shared by all the spots using it
+    Interned& in = InternCache[token];
+    if (!in.range) {
+        vector<Hand> combos = combo_list(set);
+        if (combos.empty() || combos.size() > MAX_RANGE)
+            return false;
+        in.range = std::make_shared<const Range>(combos, token);
+    }
 
+    ranges[player] = in.range;
+    print_range(player);
     return true;
 }
 
+void Spot::print_range(int player) const
+{
+    cout << "Set range " << ranges[player]->token << " for player " << player + 1
+         << " of size: " << ranges[player]->size << endl;
+}
+
+/// Print the ranges as they were set at parsing, for a spot reused from a cache
+void Spot::print_ranges() const
+{
+    for (const int* ci = combosId; *ci != -1; ++ci)
+        print_range(*ci);
+}
+
 /// Initialize a Spot from a given string like:
 ///
 ///  4P AcTc TdTh - 5h 6h 9c
@@ -191,7 +441,7 @@ Spot::Spot(int playersNum, const std::string& pos)
     string token;
     stringstream ss(pos);
 
-    if (playersNum < 2 || playersNum > 9)
+    if (playersNum < 1 || playersNum > 9)
         return;
 
     memset(givenHoles, 0, sizeof(givenHoles));
@@ -201,6 +451,7 @@ Spot::Spot(int playersNum, const std::string& pos)
     givenCommon.suits = SuitInit; // Only givenCommon is set with SuitInit
     prng = nullptr;
     enumMask = rangeMask = 0;
+    deadCards = 0;
     ready = false;
 
     ss >> skipws;
@@ -248,27 +499,20 @@ Spot::Spot(int playersNum, const std::string& pos)
         enumMask = (enumMask << missingCommons) | v;
         rangeMask <<= missingCommons;
     }
-    givenAllMask = all.cards | FlagsArea;
+    givenAllMask = all.cards | Deck::Absent;
     ready = true;
 }
 
-/// Run a single spot and update results vector. First generate hole cards for
-/// given ranges, then common cards, then free hole cards. Finally score the
-/// hands and find the max among them.
-void Spot::run(Result results[])
+/// Generate givenHoles instances out of the given ranges, if any, and return
+/// the updated mask of the cards already in use.
+inline uint64_t Spot::deal_ranges(uint64_t allMask)
 {
-    Hand hands[PLAYERS_NB];
-    unsigned maxId = 0, split = 0;
-    uint64_t maxScore = 0;
-    Hand common = givenCommon;
-    uint64_t allMask = givenAllMask;
-
-    // First generate givenHoles instances out of the given ranges, if any
     const int* ci = combosId;
     while (*ci != -1) {
         uint64_t n = prng->next();
         for (unsigned i = 0; i <= 64 - 9; i += 9) {
-            givenHoles[*ci] = combos[*ci][(n >> i) & 0x1FF];
+            const Range& r = *ranges[*ci];
+            givenHoles[*ci] = r[r.pick[(n >> i) & 0x1FF]];
             if (givenHoles[*ci].cards & allMask)
                 continue;
             allMask |= givenHoles[*ci].cards;
@@ -276,6 +520,64 @@ void Spot::run(Result results[])
                 break;
         }
     }
+    return allMask;
+}
+
+/// Score the hands, find the winner and update results. The player with the
+/// highest score bound is scored first, then the players whose bound is below
+/// the best score so far, and that cannot make a flush or a straight, are
+/// skipped: they can neither win nor tie, so results are the same as scoring
+/// everybody. Skipped hands remain unscored.
+template<typename E>
+inline void Spot::showdown(Hand hands[], Result results[]) const
+{
+    unsigned maxId = 0, split = 0;
+    uint64_t maxScore, bound[PLAYERS_NB];
+
+    for (unsigned i = 0; i < numPlayers; ++i) {
+        bound[i] = hands[i].score_bound();
+        if (bound[maxId] < bound[i])
+            maxId = i;
+    }
+
+    // Remember the first scored hand: scoring is not idempotent
+    const unsigned first = maxId;
+    E::score(hands[first]);
+    maxScore = hands[first].score;
+
+    for (unsigned i = 0; i < numPlayers; ++i) {
+        if (   i == first
+            || (bound[i] < maxScore && !hands[i].flush_or_straight()))
+            continue;
+
+        E::score(hands[i]);
+        if (maxScore < hands[i].score) {
+            maxScore = hands[i].score;
+            maxId = i;
+            split = 0;
+        } else if (maxScore == hands[i].score)
+            split++;
+    }
+
+    // An unscored hand has a score below its bound, so never equal to maxScore
+    if (!split)
+        results[maxId].first++;
+    else
+        for (unsigned i = 0; i < numPlayers; ++i) {
+            if (hands[i].score == maxScore)
+                results[i].second += KTie / (split + 1);
+        }
+}
+
+/// Deal a single game. First generate hole cards for given ranges, then common
+/// cards, then free hole cards. Hands are returned unscored.
+inline void Spot::deal(Hand hands[], Hand& common)
+{
+    uint64_t allMask = givenAllMask;
+    common = givenCommon;
+
+    // First generate givenHoles instances out of the given ranges, if any
+    allMask = deal_ranges(allMask);
 
     // Then complete the common 5-card board
     unsigned cnt = missingCommons;
@@ -291,18 +593,141 @@ void Spot::run(Result results[])
         hands[i].merge(givenHoles[i]);
     }
 
-    // Finally fill the missing hole cards (single or double)
+    // Finally fill the missing hole cards (single or double), updating allMask
+    // so that two players are never dealt the same card.
     const int* mi = missingHolesId;
     while (*mi != -1) {
         uint64_t n = prng->next();
         for (unsigned i = 0; i <= 64 - 6; i += 6)
-            if (hands[*mi].add(Card((n >> i) & 0x3F), allMask) && *(++mi) == -1)
-                break;
+            if (hands[*mi].add(Card((n >> i) & 0x3F), allMask)) {
+                allMask |= 1ULL << ((n >> i) & 0x3F);
+                if (*(++mi) == -1)
+                    break;
+            }
+    }
+}
+
+/// Run a single spot and update results vector. Deal the cards, then score the
+/// hands and find the max among them.
+template<typename E>
+void Spot::run(Result results[])
+{
+    Hand hands[PLAYERS_NB], common;
+
+    deal(hands, common);
+    showdown<E>(hands, results);
+}
+
+template void Spot::run<BitboardEval>(Result results[]);
+template void Spot::run<TableEval>(Result results[]);
+
+/// Deal a single game of a full enumeration. Games in enumBuf are generated with
+/// common cards in the innermost loops, so consecutive games share the holes
+/// and a prefix of the common cards. We keep in streets[d] the players' hands
+/// after the first d missing common cards and extend them one card at a time
+/// starting from the deepest prefix shared with the previous game.
+inline void Spot::deal_incremental(Hand hands[], Hand& common)
+{
+    uint64_t rangesKey = rangeMask ? prng->next() : 0;
+    uint64_t commons = missingCommons ? prng->next() : 0;
+    uint64_t holesKey = *missingHolesId != -1 ? prng->next() : 0;
+    unsigned depth = 0;
+
+    if (rangesKey != lastRanges || holesKey != lastHoles) {
+
+        // Holes have changed, rebuild the hands out of givenCommon and holes
+        uint64_t n = rangesKey;
+        for (const int* ci = combosId; *ci != -1; ++ci, n >>= 9)
+            givenHoles[*ci] = (*ranges[*ci])[n & 0x1FF];
+
+        for (unsigned i = 0; i < numPlayers; ++i) {
+            streets[0][i] = givenCommon;
+            streets[0][i].merge(givenHoles[i]);
+        }
+        boards[0] = givenCommon;
+
+        n = holesKey;
+        for (const int* mi = missingHolesId; *mi != -1; ++mi, n >>= 6)
+            streets[0][*mi].add(Card(n & 0x3F), 0);
+
+        lastRanges = rangesKey;
+        lastHoles = holesKey;
+    } else if (commons != lastCommons)
+        depth = lsb(commons ^ lastCommons) / 6;
+    else
+        depth = missingCommons;
+
+    lastCommons = commons;
+
+    for (unsigned d = depth; d < missingCommons; ++d) {
+        Card c = Card((commons >> (6 * d)) & 0x3F);
+        boards[d + 1] = boards[d];
+        boards[d + 1].add(c, 0);
+        for (unsigned i = 0; i < numPlayers; ++i) {
+            streets[d + 1][i] = streets[d][i];
+            streets[d + 1][i].add(c, 0);
+        }
     }
 
-    // Now we are ready to score hands and find the winner
+    std::copy(streets[missingCommons], streets[missingCommons] + numPlayers, hands);
+    common = boards[missingCommons];
+}
+
+/// Run a single game of a full enumeration and update results vector
+template<typename E>
+void Spot::run_incremental(Result results[])
+{
+    Hand hands[PLAYERS_NB], common;
+
+    deal_incremental(hands, common);
+    showdown<E>(hands, results);
+}
+
+template void Spot::run_incremental<BitboardEval>(Result results[]);
+template void Spot::run_incremental<TableEval>(Result results[]);
+
+/// Play k games together, with k up to MAX_INTERLEAVE, dealt like run() or, when
+/// enumerated, like run_incremental(). Each game is a long chain of dependent
+/// steps, so they go in phases: first all the deals, in the same order of the
+/// single games so that results are the same, then the prefetch of the table
+/// entries of every hand and finally the showdowns. The CPU can overlap the
+/// independent chains of different games and the loads have time to arrive.
+template<typename E>
+void Spot::run_interleaved(Result results[], unsigned k, bool enumerated)
+{
+    Hand hands[MAX_INTERLEAVE][PLAYERS_NB], common[MAX_INTERLEAVE];
+
+    for (unsigned g = 0; g < k; ++g)
+        if (enumerated)
+            deal_incremental(hands[g], common[g]);
+        else
+            deal(hands[g], common[g]);
+
+    for (unsigned g = 0; g < k; ++g)
+        for (unsigned i = 0; i < numPlayers; ++i)
+            E::prefetch(hands[g][i]);
+
+    for (unsigned g = 0; g < k; ++g)
+        showdown<E>(hands[g], results);
+}
+
+template void Spot::run_interleaved<BitboardEval>(Result[], unsigned, bool);
+template void Spot::run_interleaved<TableEval>(Result[], unsigned, bool);
+
+/// Like showdown(), but every hand is scored to count its category, and the
+/// pots won and tied are counted also by the category of the winning hands.
+template<typename E>
+inline void Spot::showdown_categories(Hand hands[], Result results[], Categories& ct) const
+{
+    unsigned maxId = 0, split = 0;
+    uint64_t maxScore = 0;
+    HandCategory cat[PLAYERS_NB];
+
     for (unsigned i = 0; i < numPlayers; ++i) {
-        hands[i].do_score();
+        E::score(hands[i]);
+        cat[i] = category(hands[i].score);
+        ct.made[i][cat[i]]++;
+
         if (maxScore < hands[i].score) {
             maxScore = hands[i].score;
             maxId = i;
@@ -311,113 +736,1272 @@ void Spot::run(Result results[])
             split++;
     }
 
-    if (!split)
+    if (!split) {
         results[maxId].first++;
+        ct.won[maxId][cat[maxId]].first++;
+    }
     else
-        for (unsigned i = 0; i < numPlayers; ++i) {
-            if (hands[i].score == maxScore)
+        for (unsigned i = 0; i < numPlayers; ++i)
+            if (hands[i].score == maxScore) {
                 results[i].second += KTie / (split + 1);
-        }
+                ct.won[i][cat[i]].second += KTie / (split + 1);
+            }
 }
 
-/// Recursively compute all possible combinations (not permutations) of missing
-/// cards for each hole group and common cards. Then add the cards to enumBuf
-/// from where Spot::run() will fetch instead of using the PRNG. We push one
-/// uint64_t (that can pack up to 10 cards) for the missing commons cards and
-/// one for the missing hole cards.
-void Spot::enumerate(std::vector<uint64_t>& buf, unsigned missing,
-                     uint64_t rnd64[], int shift[], int limit,
-                     size_t idx, size_t threadsNum)
+/// Run a single game, dealt like run() or run_incremental() when enumerated,
+/// and update results and the categories. Results are the same of run().
+template<typename E>
+void Spot::run_categories(Result results[], Categories& ct, bool enumerated)
 {
-    // At group boundaries enumMask is 1. We reset to 64 in this case
-    uint32_t groupBoundary = enumMask & (1 << (missing - 1));
-    unsigned end = groupBoundary ? 64 : limit;
-    Hand* cmb = nullptr;
+    Hand hands[PLAYERS_NB], common;
 
-    // Check if this new group is also a range and in this case get the
-    // corresponding combo vector.
-    if (groupBoundary & rangeMask) {
-        // Count how many ranges there are before this one
-        int cnt = popcount(rangeMask & ~(groupBoundary - 1)) - 1;
+    if (enumerated)
+        deal_incremental(hands, common);
+    else
+        deal(hands, common);
 
-        assert(cnt >= 0 && combosId[cnt] != -1);
+    showdown_categories<E>(hands, results, ct);
+}
 
-        cmb = combos[combosId[cnt]];
+template void Spot::run_categories<BitboardEval>(Result[], Categories&, bool);
+template void Spot::run_categories<TableEval>(Result[], Categories&, bool);
 
-        // Look for the range's end of the first replication
-        for (end = 1; end < MAX_RANGE; ++end)
-            if (cmb[end].cards == cmb[0].cards || cmb[end].cards == COMBO_EOF)
-                break;
+/// Run a single game for the opponents of a hero's range, then score every
+/// hero's combo not conflicting with the dealt cards against the same board
+/// and opponents. So every board and opponents' hands, sampled or enumerated,
+/// are shared among all the combos of the range.
+void Spot::run_matrix(Matrix& mx, bool enumerated)
+{
+    Hand hands[PLAYERS_NB], common;
+    unsigned split = 0;
+    uint64_t maxScore = 0, dealt = 0;
+
+    if (enumerated)
+        deal_incremental(hands, common);
+    else
+        deal(hands, common);
+
+    for (unsigned i = 0; i < numPlayers; ++i) {
+        dealt |= hands[i].cards;
+        hands[i].do_score();
+        if (maxScore < hands[i].score) {
+            maxScore = hands[i].score;
+            split = 0;
+        } else if (maxScore == hands[i].score)
+            split++;
     }
-    shift[!!cmb] += (cmb ? 9 : 6);
 
-    for (unsigned c = 0; c < end; ++c) {
+    for (size_t c = 0; c < mx.combos.size(); ++c) {
 
-        // Split the cards among the threads. Only at root level
-        if (threadsNum && idx != (c % threadsNum))
+        if (mx.combos[c].cards & dealt)
             continue;
 
-        uint64_t n = cmb ? cmb[c].cards : 1ULL << c;
+        Hand h = common;
+        h.merge(mx.combos[c]);
+        h.do_score();
+        mx.games[c]++;
 
-        if (givenAllMask & n)
-            continue;
+        if (maxScore < h.score)
+            mx.results[c].first++;
+        else if (maxScore == h.score)
+            mx.results[c].second += KTie / (split + 2);
+    }
+}
 
-        rnd64[!!cmb] += c << shift[!!cmb]; // Append the new card/index
+/// Run a single game like Spot::run() and add each player's equity share and
+/// its square to the estimate. With antithetic sampling the game is played
+/// again for each suit permutation in e.perms, applied to the random cards
+/// only, and the average of all the results is recorded as a single sample.
+void Spot::run_estimate(Result results[], Estimate& e)
+{
+    Hand hands[PLAYERS_NB], common, h[PLAYERS_NB];
+    double x[PLAYERS_NB] = {};
+    uint64_t fixed[PLAYERS_NB];
 
-        if (missing == (cmb ? 2 : 1)) {
-            if (rangeMask)
-                buf.push_back(rnd64[1]);
+    deal(hands, common);
 
-            unsigned sh = shift[0] - 6 * (missingCommons - 1);
+    // Given cards that are not changed by the permutations
+    for (unsigned i = 0; i < numPlayers; ++i)
+        fixed[i] = givenHoles[i].cards | givenCommon.cards;
+    for (const int* ci = combosId; *ci != -1; ++ci)
+        fixed[*ci] = givenCommon.cards;
 
-            if (missingCommons)
-                buf.push_back(rnd64[0] >> sh);
+    for (int p : e.perms) {
+        Result r[PLAYERS_NB] = {};
 
-            if (sh > 0) { // We have some missing holes
-                unsigned mask = (1 << sh) - 1;
-                buf.push_back(rnd64[0] & mask);
-            }
-        } else {
-            givenAllMask |= n;
-            enumerate(buf, missing - (cmb ? 2 : 1), rnd64, shift, c, idx, 0);
-            givenAllMask ^= n;
+        for (unsigned i = 0; i < numPlayers; ++i)
+            h[i] = p ? make_hand(fixed[i] | permute(hands[i].cards & ~fixed[i], p))
+                     : hands[i];
+
+        showdown(h, r);
+
+        for (unsigned i = 0; i < numPlayers; ++i) {
+            x[i] += (KTie * r[i].first + r[i].second) / double(KTie);
+            results[i].first += r[i].first;
+            results[i].second += r[i].second;
         }
-        rnd64[!!cmb] -= c << shift[!!cmb];
     }
-    shift[!!cmb] -= (cmb ? 9 : 6);
+
+    for (unsigned i = 0; i < numPlayers; ++i) {
+        x[i] /= e.perms.size();
+        e.sum[i] += x[i];
+        e.sumSq[i] += x[i] * x[i];
+    }
+    e.samples++;
 }
 
-/// Setup to run a full enumeration instead of the Monte Carlo simulation. This
-/// is possible when the number of missing cards is limited. Full enumeration is
-/// implemented in 2 steps: first all the combinations for the missing cards are
-/// computed and saved in enumBuf, then Spot::run() is called as usual, but
-/// instead of fetching cards from the PRNG, it will fetch from enumBuf. Here
-/// we implement the first step: computation of all the possible combinations.
-size_t Spot::set_enumerate(std::vector<uint64_t>& enumBuf,
-                           size_t idx, size_t threadsNum)
+/// Find the suit permutations that leave the spot unchanged. The ones in group
+/// map each player's given cards, the given common cards and each range into
+/// themselves, so applied to a whole game they don't change its result. The
+/// ones in cosets, one for each right coset of group, map only the set of all
+/// the given cards and each range into themselves: applied to the random cards
+/// of a game they give a different game with the same probability.
+///
+/// The cards in common are added to the given common cards, as for a stratum.
+/// Checking the ranges is the costly part, so the permutations that map them
+/// into themselves are stored in closed at the first call and then reused.
+void Spot::symmetries(vector<int>& group, vector<int>& cosets,
+                      vector<int>& closed, uint64_t common) const
 {
-    unsigned given = popcount(givenAllMask & ~FlagsArea);
-    unsigned missing = 5 + 2 * numPlayers - given;
-    unsigned missingHoles = missing - missingCommons - 2 * popcount(rangeMask);
-    unsigned limit = 5 + 3 * popcount(rangeMask) / 2;
+    uint64_t given = givenAllMask & ~Deck::Absent;
+    uint64_t dead = given | common, commons = givenCommon.cards | common;
+    vector<int> all;
 
-    if (missing == 0)
-        return 0;
+    // Every permuted combo should be in the same range
+    if (closed.empty())
+        for (int p = 0; p < 24; ++p) {
 
-    if (missing > limit) {
-        cout << "Missing too many cards" << endl;
-        return 0;
-    }
-    uint64_t rnd64[] = {0, 0};
-    int shift[] = {-6, -9}; // Skip first shift
-    enumBuf.clear();
-    enumerate(enumBuf, missing, rnd64, shift, 64, idx, threadsNum);
-    size_t gamesNum = enumBuf.size();
+            if (permute(given, p) != given)
+                continue;
 
-    // We have 2/3 entries (instead of 1) for a single game in enumBuf in case
+            bool ok = true;
+            for (const int* ci = combosId; *ci != -1 && ok; ++ci) {
+                const Range& r = *ranges[*ci];
+                for (size_t c = 0; c < r.size && ok; ++c)
+                    ok = std::find(r.cards, r.cards + r.size,
+                                   permute(r.cards[c], p)) != r.cards + r.size;
+            }
+            if (ok)
+                closed.push_back(p);
+        }
+
+    for (int p : closed) {
+
+        if (permute(dead, p) != dead)
+            continue;
+
+        bool fixes = permute(commons, p) == commons;
+
+        // Ranges' givenHoles are overwritten at each game, so skip them
+        for (unsigned i = 0; i < numPlayers; ++i) {
+            bool isRange = false;
+            for (const int* ci = combosId; *ci != -1; ++ci)
+                isRange = isRange || *ci == int(i);
+
+            if (!isRange && permute(givenHoles[i].cards, p) != givenHoles[i].cards)
+                fixes = false;
+        }
+
+        all.push_back(p);
+        if (fixes)
+            group.push_back(p);
+    }
+
+    // Permutations s and t give the same result if s = g * t with g in group.
+    // To compare permutations apply them to a bitboard with a card per suit.
+    constexpr uint64_t B = 1 | (2ULL << 16) | (4ULL << 32) | (8ULL << 48);
+
+    for (int s : all) {
+        bool found = false;
+        for (int t : cosets)
+            for (int g : group)
+                found = found || permute(permute(B, t), g) == permute(B, s);
+        if (!found)
+            cosets.push_back(s);
+    }
+}
+
+namespace {
+
+/// Walk all the k-combinations of the cards not in dead in lexicographic order
+/// and add to out the ones that are the smallest of their orbit under the suit
+/// permutations in group, with the size of the orbit as weight.
+void canonical_sets(uint64_t dead, unsigned k, const vector<int>& group,
+                    vector<Stratum>& out)
+{
+    uint64_t free = ~dead;
+    vector<unsigned> cards;
+    while (free)
+        cards.push_back(pop_lsb(&free));
+
+    vector<unsigned> idx(k);
+    for (unsigned i = 0; i < k; ++i)
+        idx[i] = i;
+
+    while (true) {
+        uint64_t b = 0;
+        for (unsigned i : idx)
+            b |= 1ULL << cards[i];
+
+        uint64_t canonical = b;
+        for (int g : group)
+            canonical = std::min(canonical, permute(b, g));
+
+        if (canonical == b) {
+            vector<uint64_t> orbit;
+            for (int g : group)
+                orbit.push_back(permute(b, g));
+            std::sort(orbit.begin(), orbit.end());
+            out.push_back({ b, double(std::unique(orbit.begin(), orbit.end()) - orbit.begin()) });
+        }
+
+        int i = k - 1;
+        while (i >= 0 && idx[i] == cards.size() - k + i)
+            --i;
+        if (i < 0)
+            break;
+        ++idx[i];
+        for (unsigned j = i + 1; j < k; ++j)
+            idx[j] = idx[j - 1] + 1;
+    }
+}
+
+} // namespace
+
+/// Split the games in strata by their first k = min(3, missingCommons) common
+/// cards, typically the flop. Sets of cards equivalent under a permutation in
+/// group give the same results, so are merged in a single stratum. Weights are
+/// exact with up to one range, so we don't support more.
+bool Spot::strata(const vector<int>& group, vector<Stratum>& out) const
+{
+    unsigned k = std::min(missingCommons, 3U);
+    uint64_t dead = givenAllMask;
+    const Range* range = *combosId != -1 ? ranges[*combosId].get() : nullptr;
+    vector<Stratum> sets;
+    double total = 0;
+
+    if (!k || (range && combosId[1] != -1))
+        return false;
+
+    canonical_sets(dead, k, group, sets);
+
+    for (Stratum s : sets) {
+        // With a range, weight by the number of combos that can be dealt
+        if (range) {
+            int cnt = 0;
+            for (size_t c = 0; c < range->size; ++c)
+                cnt += !(range->cards[c] & (dead | s.cards));
+            s.weight *= cnt;
+        }
+        if (s.weight > 0)
+            out.push_back(s);
+        total += s.weight;
+    }
+
+    for (Stratum& s : out)
+        s.weight /= total;
+
+    return true;
+}
+
+/// The flops of a spot without common cards, merging the ones equivalent under
+/// the suit permutations that leave the spot unchanged. With no given cards and
+/// suit symmetric ranges they are the 1755 canonical flops, weighted by the
+/// number of flops they stand for. As in strata(), the deals of each flop are
+/// the combos that can be dealt with it: the combos of a single range, the
+/// pairs of combos not sharing a card with two ranges, and the product of the
+/// combos of each range with more. Flops that leave a range with no combo are
+/// dropped.
+bool Spot::flops(vector<Stratum>& out, vector<double>& outDeals) const
+{
+    vector<int> group, cosets, closed;
+    vector<Stratum> sets;
+    vector<uint64_t> dealable[2];
+
+    if (missingCommons != 5)
+        return false;
+
+    symmetries(group, cosets, closed);
+    canonical_sets(givenAllMask, 3, group, sets);
+
+    for (Stratum s : sets) {
+        uint64_t dead = givenAllMask | s.cards;
+        double deals = 1;
+        int n = 0;
+
+        for (const int* ci = combosId; *ci != -1; ++ci, ++n) {
+            const Range* range = ranges[*ci].get();
+            vector<uint64_t>& d = dealable[std::min(n, 1)];
+
+            d.clear();
+            for (size_t c = 0; c < range->size; ++c)
+                if (!(range->cards[c] & dead))
+                    d.push_back(range->cards[c]);
+
+            deals *= d.size();
+        }
+
+        // The combos of the second range clashing with one of the first are
+        // the ones with either of its cards, counting once the same combo.
+        if (n == 2 && deals > 0) {
+            const vector<uint64_t>& a = dealable[0];
+            vector<uint64_t>& b = dealable[1];
+            int withCard[64] = {};
+
+            for (uint64_t cards : b)
+                for (uint64_t bb = cards; bb; )
+                    withCard[pop_lsb(&bb)]++;
+
+            std::sort(b.begin(), b.end());
+            deals = 0;
+
+            for (uint64_t cards : a) {
+                uint64_t bb = cards;
+                unsigned c1 = pop_lsb(&bb), c2 = pop_lsb(&bb);
+                int clash =  withCard[c1] + withCard[c2]
+                           - std::binary_search(b.begin(), b.end(), cards);
+                deals += int(b.size()) - clash;
+            }
+        }
+        if (deals > 0) {
+            out.push_back(s);
+            outDeals.push_back(deals);
+        }
+    }
+    return true;
+}
+
+/// Setup the estimators selected with -m, return false if not applicable
+bool Spot::set_estimate(Mode mode, Estimate& e) const
+{
+    vector<int> group, cosets, closed;
+
+    symmetries(group, cosets, closed);
+    e.perms = (mode & ANTITHETIC) ? cosets : vector<int>(1, 0);
+
+    if (mode & ANTITHETIC)
+        cout << "Antithetic sampling with " << e.perms.size()
+             << " suit permutations" << endl;
+
+    if (mode & STRATIFIED) {
+        if (!strata(group, e.strata)) {
+            cout << "Stratified sampling needs missing common cards and "
+                 << "at most one range" << endl;
+            return false;
+        }
+        cout << "Stratified sampling over " << e.strata.size() << " strata" << endl;
+
+        // The cards of a stratum are given cards of its games, so its own
+        // permutations must map them into themselves too.
+        e.strataPerms.clear();
+        if (mode & ANTITHETIC)
+            for (const Stratum& s : e.strata) {
+                vector<int> g, c;
+                symmetries(g, c, closed, s.cards);
+                e.strataPerms.push_back(c);
+            }
+    }
+    return true;
+}
+
+/// Replace the given common cards, return false if they conflict with the
+/// given hole cards or are more than 5.
+bool Spot::set_common(uint64_t cards)
+{
+    uint64_t holes = (givenAllMask & ~Deck::Absent) ^ givenCommon.cards;
+
+    if ((cards & (holes | Deck::Absent)) || popcount(cards) > 5)
+        return false;
+
+    enumMask >>= missingCommons;
+    rangeMask >>= missingCommons;
+    missingCommons = 5 - popcount(cards);
+    if (missingCommons) {
+        unsigned v = 1 << (missingCommons - 1);
+        enumMask = (enumMask << missingCommons) | v;
+        rangeMask <<= missingCommons;
+    }
+    givenCommon = make_hand(cards);
+    givenAllMask = holes | cards | Deck::Absent;
+    return true;
+}
+
+/// Remove from the deck some cards seen out of play, like the folded ones, so
+/// that they are dealt neither as common nor as hole cards. Return false if
+/// they are already in use.
+bool Spot::set_dead(uint64_t cards)
+{
+    if (cards & givenAllMask)
+        return false;
+
+    deadCards |= cards;
+    givenAllMask |= cards;
+    return true;
+}
+
+/// True if the first player has both hole cards given and all the others are
+/// random opponents, without any given card or range.
+bool Spot::vs_random() const
+{
+    if (popcount(givenHoles[0].cards) != 2 || *combosId != -1)
+        return false;
+
+    for (unsigned i = 1; i < numPlayers; ++i)
+        if (givenHoles[i].cards)
+            return false;
+
+    return true;
+}
+
+/// Number of the possible runouts of the missing common cards, when they are
+/// at most 2, as used by run_runout(). Return 0 with more missing cards.
+size_t Spot::runouts() const
+{
+    size_t r = Deck::Size - popcount(givenAllMask & ~Deck::Absent);
+
+    return missingCommons == 0 ? 1
+         : missingCommons == 1 ? r
+         : missingCommons == 2 ? r * (r - 1) / 2 : 0;
+}
+
+/// Play the first player against random opponents on runout k of the missing
+/// common cards. The hero and every possible opponent's hole are scored once,
+/// then heads-up we count the exact result against all the holes, and with
+/// more opponents we play the given games picking their holes among the
+/// scored ones, so that a game is just a few lookups.
+void Spot::run_runout(Result results[], uint64_t k, size_t games)
+{
+    constexpr unsigned LiveNb = 45 * 44 / 2; // Holes out of the unseen cards
+    uint64_t scores[LiveNb], cards[LiveNb];
+    Card rem[52];
+    unsigned remNb = 0, live = 0;
+    Hand board = givenCommon;
+
+    for (unsigned c = 0; c < 64; ++c)
+        if (!(givenAllMask & (1ULL << c)))
+            rem[remNb++] = Card(c);
+
+    // Runouts of 2 cards are the pairs of remaining cards in lexicographic order
+    if (missingCommons == 1)
+        board.add(rem[k], 0);
+
+    else if (missingCommons == 2) {
+        unsigned i = 0;
+        while (k >= remNb - 1 - i)
+            k -= remNb - 1 - i++;
+        board.add(rem[i], 0);
+        board.add(rem[i + 1 + k], 0);
+    }
+
+    Hand hero = board;
+    hero.merge(givenHoles[0]);
+    hero.do_score();
+
+    for (unsigned i = 0; i < remNb; ++i) {
+        if (board.cards & (1ULL << rem[i]))
+            continue;
+
+        Hand h1 = board;
+        h1.add(rem[i], 0);
+
+        for (unsigned j = i + 1; j < remNb; ++j) {
+            if (board.cards & (1ULL << rem[j]))
+                continue;
+
+            Hand h = h1;
+            h.add(rem[j], 0);
+            h.do_score();
+            scores[live] = h.score;
+            cards[live++] = (1ULL << rem[i]) | (1ULL << rem[j]);
+        }
+    }
+
+    if (numPlayers == 2) {
+        for (unsigned c = 0; c < live; ++c)
+            if (hero.score > scores[c])
+                results[0].first++;
+            else if (hero.score < scores[c])
+                results[1].first++;
+            else {
+                results[0].second += KTie / 2;
+                results[1].second += KTie / 2;
+            }
+        return;
+    }
+
+    for (size_t g = 0; g < games; ++g) {
+        uint64_t sc[PLAYERS_NB], used = 0, n = 0;
+        unsigned bits = 0, maxId = 0, split = 0;
+
+        // Pick the opponents' holes with 10 random bits each, rejecting the
+        // ones out of the list or clashing with the holes already picked.
+        sc[0] = hero.score;
+        for (unsigned i = 1; i < numPlayers; ) {
+            if (bits < 10)
+                n = prng->next(), bits = 64;
+
+            unsigned idx = n & 0x3FF;
+            n >>= 10, bits -= 10;
+
+            if (idx < live && !(cards[idx] & used)) {
+                used |= cards[idx];
+                sc[i++] = scores[idx];
+            }
+        }
+
+        for (unsigned i = 1; i < numPlayers; ++i)
+            if (sc[maxId] < sc[i])
+                maxId = i, split = 0;
+            else if (sc[maxId] == sc[i])
+                split++;
+
+        if (!split)
+            results[maxId].first++;
+        else
+            for (unsigned i = 0; i < numPlayers; ++i)
+                if (sc[i] == sc[maxId])
+                    results[i].second += KTie / (split + 1);
+    }
+}
+
+/// Deal a game like Spot::run() does, but before the showdown compute the exact
+/// equity of each player after the flop and after the turn of this runout, by
+/// enumerating the remaining common cards with all the hole cards known. This
+/// gives the equity trajectories of the players along the streets.
+void Spot::run_streets(Result results[], Streets& st)
+{
+    Hand hands[PLAYERS_NB], holes[PLAYERS_NB];
+    Hand common = givenCommon;
+    Card drawn[5];
+    unsigned given = 5 - missingCommons, cnt = 0;
+    uint64_t allMask = deal_ranges(givenAllMask);
+
+    // Complete the common 5-card board, keeping track of the drawing order
+    while (cnt < missingCommons) {
+        uint64_t n = prng->next();
+        for (unsigned i = 0; i <= 64 - 6 && cnt < missingCommons; i += 6)
+            if (common.add(Card((n >> i) & 0x3F), allMask))
+                drawn[cnt++] = Card((n >> i) & 0x3F);
+    }
+    allMask |= common.cards;
+
+    // Fill the missing hole cards, here hands do not include the common cards
+    // so we need to update allMask to avoid dealing the same card twice.
+    std::copy(givenHoles, givenHoles + numPlayers, holes);
+    const int* mi = missingHolesId;
+    while (*mi != -1) {
+        uint64_t n = prng->next();
+        for (unsigned i = 0; i <= 64 - 6; i += 6)
+            if (holes[*mi].add(Card((n >> i) & 0x3F), allMask)) {
+                allMask |= 1ULL << ((n >> i) & 0x3F);
+                if (*(++mi) == -1)
+                    break;
+            }
+    }
+
+    // For flop and turn, when not already given, enumerate the remaining cards
+    for (unsigned s = std::max(given, 3U); s < 5; ++s) {
+        Result res[PLAYERS_NB] = {};
+        Hand board = givenCommon;
+        for (unsigned i = 0; i < s - given; ++i)
+            board.add(drawn[i], 0);
+
+        for (unsigned i = 0; i < numPlayers; ++i) {
+            hands[i] = board;
+            hands[i].merge(holes[i]);
+        }
+        uint64_t dead = (allMask & ~common.cards) | board.cards;
+        double leaves = double(KTie) * enumerate_board(hands, 5 - s, dead, 64, res);
+
+        for (unsigned i = 0; i < numPlayers; ++i) {
+            double eq = (KTie * res[i].first + res[i].second) / leaves;
+            st.equity[s - 3][i] += eq;
+            st.histo[s - 3][i][std::min(int(eq * BINS_NB), BINS_NB - 1)]++;
+        }
+        st.games[s - 3]++;
+    }
+
+    // Finally the river, this is the usual showdown
+    for (unsigned i = 0; i < numPlayers; ++i) {
+        hands[i] = common;
+        hands[i].merge(holes[i]);
+    }
+    showdown(hands, results);
+}
+
+/// Enumerate all the combinations of the missing common cards not in dead mask,
+/// adding them one at a time to the given hands, and update results with the
+/// showdown of each one. Return the number of combinations.
+size_t Spot::enumerate_board(const Hand hands[], unsigned missing, uint64_t dead,
+                             unsigned limit, Result results[]) const
+{
+    Hand h[PLAYERS_NB];
+    size_t cnt = 0;
+
+    for (unsigned c = 0; c < limit; ++c) {
+
+        if (dead & (1ULL << c))
+            continue;
+
+        for (unsigned i = 0; i < numPlayers; ++i) {
+            h[i] = hands[i];
+            h[i].add(Card(c), 0);
+        }
+
+        if (missing == 1) {
+            showdown(h, results);
+            cnt++;
+        } else
+            cnt += enumerate_board(h, missing - 1, dead | (1ULL << c), c, results);
+    }
+    return cnt;
+}
+
+/// Recursively compute all possible combinations (not permutations) of missing
+/// cards for each hole group and common cards. Then add the cards to enumBuf
+/// from where Spot::run() will fetch instead of using the PRNG. We push one
+/// uint64_t (that can pack up to 10 cards) for the missing commons cards and
+/// one for the missing hole cards.
+void Spot::enumerate(std::vector<uint64_t>& buf, unsigned missing,
+                     uint64_t rnd64[], int shift[], int limit)
+{
+    // At group boundaries enumMask is 1. We reset to 64 in this case
+    uint32_t groupBoundary = enumMask & (1 << (missing - 1));
+    unsigned end = groupBoundary ? 64 : limit;
+    const Range* cmb = nullptr;
+
+    // Check if this new group is also a range and in this case get the
+    // corresponding combos.
+    if (groupBoundary & rangeMask) {
+        // Count how many ranges there are before this one
+        int cnt = popcount(rangeMask & ~(groupBoundary - 1)) - 1;
+
+        assert(cnt >= 0 && combosId[cnt] != -1);
+
+        cmb = ranges[combosId[cnt]].get();
+        end = unsigned(cmb->size);
+    }
+    shift[!!cmb] += (cmb ? 9 : 6);
+
+    for (unsigned c = 0; c < end; ++c) {
+
+        uint64_t n = cmb ? cmb->cards[c] : 1ULL << c;
+
+        if (givenAllMask & n)
+            continue;
+
+        rnd64[!!cmb] += c << shift[!!cmb]; // Append the new card/index
+
+        if (missing == (cmb ? 2 : 1)) {
+            if (rangeMask)
+                buf.push_back(rnd64[1]);
+
+            unsigned sh = shift[0] - 6 * (missingCommons - 1);
+
+            if (missingCommons)
+                buf.push_back(rnd64[0] >> sh);
+
+            if (sh > 0) { // We have some missing holes
+                unsigned mask = (1 << sh) - 1;
+                buf.push_back(rnd64[0] & mask);
+            }
+        } else {
+            givenAllMask |= n;
+            enumerate(buf, missing - (cmb ? 2 : 1), rnd64, shift, c);
+            givenAllMask ^= n;
+        }
+        rnd64[!!cmb] -= c << shift[!!cmb];
+    }
+    shift[!!cmb] -= (cmb ? 9 : 6);
+}
+
+/// True if some cards are missing, but not too many for a full enumeration
+bool Spot::enumerable() const
+{
+    unsigned missing = 5 + 2 * numPlayers - popcount(givenAllMask & ~(Deck::Absent | deadCards));
+    unsigned limit = 5 + 3 * popcount(rangeMask) / 2;
+
+    return missing && missing <= limit;
+}
+
+/// True if all the cards are given, so that a single game settles the spot
+bool Spot::complete() const
+{
+    return popcount(givenAllMask & ~(Deck::Absent | deadCards)) == int(5 + 2 * numPlayers);
+}
+
+/// Setup to run a full enumeration instead of the Monte Carlo simulation. This
+/// is possible when the number of missing cards is limited. Full enumeration is
+/// implemented in 2 steps: first all the combinations for the missing cards are
+/// computed and saved in enumBuf, then Spot::run() is called as usual, but
+/// instead of fetching cards from the PRNG, it will fetch from enumBuf. Here
+/// we implement the first step: computation of all the possible combinations.
+size_t Spot::set_enumerate(std::vector<uint64_t>& enumBuf, bool verbose)
+{
+    unsigned given = popcount(givenAllMask & ~(Deck::Absent | deadCards));
+    unsigned missing = 5 + 2 * numPlayers - given;
+    unsigned missingHoles = missing - missingCommons - 2 * popcount(rangeMask);
+    unsigned limit = 5 + 3 * popcount(rangeMask) / 2;
+
+    if (missing == 0)
+        return 0;
+
+    if (missing > limit) {
+        if (verbose)
+            cout << "Missing too many cards" << endl;
+        return 0;
+    }
+    uint64_t rnd64[] = {0, 0};
+    int shift[] = {-6, -9}; // Skip first shift
+    enumBuf.clear();
+    lastRanges = lastHoles = COMBO_EOF; // Force a rebuild at first game
+    enumerate(enumBuf, missing, rnd64, shift, 64);
+    size_t gamesNum = enumBuf.size();
+
+    // We have 2/3 entries (instead of 1) for a single game in enumBuf in case
     // common and/or hole cards and/or ranges are missing.
     gamesNum /= !!missingCommons + !!missingHoles + !!rangeMask;
 
-    cout << "Evaluating " << gamesNum << " combinations..." << endl;
+    if (verbose)
+        cout << "Evaluating " << gamesNum << " combinations..." << endl;
     return gamesNum;
 }
+
+namespace {
+
+uint64_t binomial(unsigned n, unsigned k)
+{
+    uint64_t r = 1;
+    for (unsigned i = 1; i <= k; ++i)
+        r = r * (n - k + i) / i;
+    return k > n ? 0 : r;
+}
+
+// Expand an Omaha range token like [AAxx,KQJTds,AhAdKsQs] in the list of its
+// 4 cards combos. A term is a specific combo or 4 ranks, where 'x' is any rank,
+// optionally followed by ds (double suited), ss (single suited) or r (rainbow).
+// Ranks are matched as a multiset, so AAxx includes the hands with 3 aces too.
+bool expand_omaha(const string& token, vector<uint64_t>& combos)
+{
+    struct Term {
+        int ranks[13];
+        string suits;
+        uint64_t cards;
+    };
+    vector<Term> terms;
+    string t = token;
+
+    if (t.front() == '[' && t.back() == ']')
+        t = t.substr(1, t.size() - 2);
+
+    stringstream ss(t);
+    while (getline(ss, t, ',')) {
+        Term term = {};
+        Hand h = Hand(), all = Hand();
+
+        if (t.size() == 8 && parse_cards(t, h, all, 4)) {
+            term.cards = h.cards;
+            terms.push_back(term);
+            continue;
+        }
+        for (size_t i = 0; i < 4; ++i) {
+            size_t v = i < t.size() ? Values.find(t[i]) : string::npos;
+            if (v != string::npos)
+                term.ranks[v]++;
+            else if (i >= t.size() || t[i] != 'x')
+                return false;
+        }
+        term.suits = t.substr(4);
+        if (term.suits != "" && term.suits != "ds" && term.suits != "ss" && term.suits != "r")
+            return false;
+        terms.push_back(term);
+    }
+
+    vector<unsigned> deck;
+    for (unsigned c = 0; c < 64; ++c)
+        if (in_deck(c))
+            deck.push_back(c);
+
+    for (size_t i1 = 0; i1 < deck.size(); ++i1)
+        for (size_t i2 = i1 + 1; i2 < deck.size(); ++i2)
+            for (size_t i3 = i2 + 1; i3 < deck.size(); ++i3)
+                for (size_t i4 = i3 + 1; i4 < deck.size(); ++i4) {
+                    unsigned c[] = { deck[i1], deck[i2], deck[i3], deck[i4] };
+                    uint64_t b = 0;
+                    int ranks[13] = {}, suits[4] = {};
+                    for (unsigned x : c) {
+                        b |= 1ULL << x;
+                        ranks[x % 16]++;
+                        suits[x / 16]++;
+                    }
+                    int pairs = 0, singles = 0;
+                    for (int s : suits)
+                        pairs += s == 2, singles += s == 1;
+
+                    for (const Term& term : terms) {
+                        bool ok = term.cards ? term.cards == b : true;
+                        for (int v = 0; v < 13 && ok && !term.cards; ++v)
+                            ok = term.ranks[v] <= ranks[v];
+
+                        if (   !ok
+                            || (term.suits == "ds" && pairs != 2)
+                            || (term.suits == "ss" && (pairs != 1 || singles != 2))
+                            || (term.suits == "r" && singles != 4))
+                            continue;
+
+                        combos.push_back(b);
+                        break;
+                    }
+                }
+    return true;
+}
+
+} // namespace
+
+void OmahaBoard::set(uint64_t common)
+{
+    Card c[5];
+    int n = 0;
+
+    while (common)
+        c[n++] = Card(pop_lsb(&common));
+
+    n = 0;
+    for (int i = 0; i < 5; ++i)
+        for (int j = i + 1; j < 5; ++j)
+            for (int k = j + 1; k < 5; ++k) {
+                Hand& t = triples[n++];
+                t = Hand();
+                t.suits = SuitInit;
+                t.add(c[i], 0);
+                t.add(c[j], 0);
+                t.add(c[k], 0);
+            }
+}
+
+/// Best score of an Omaha hand out of 2 of its 4 hole cards and 3 of the common
+/// cards. The board's triples are shared by all the players and each pair of
+/// hole cards is built once, then a 5 cards hand is scored only if its bound,
+/// see Hand::score_bound(), can reach the best score so far or floor, or if it
+/// could make a flush or a straight. The result is exact when not below floor.
+uint64_t omaha_score(const OmahaBoard& b, uint64_t holes, uint64_t floor)
+{
+    Card c[OMAHA_HOLE_NB];
+    uint64_t best = 0;
+
+    for (int i = 0; i < OMAHA_HOLE_NB; ++i)
+        c[i] = Card(pop_lsb(&holes));
+
+    for (int i = 0; i < OMAHA_HOLE_NB; ++i)
+        for (int j = i + 1; j < OMAHA_HOLE_NB; ++j) {
+            Hand pair = Hand();
+            pair.add(c[i], 0);
+            pair.add(c[j], 0);
+
+            for (const Hand& t : b.triples) {
+                Hand h = t;
+                h.merge(pair);
+
+                uint64_t bound = h.score_bound();
+                if ((bound < floor || bound <= best) && !h.flush_or_straight())
+                    continue;
+
+                h.do_score();
+                best = std::max(best, h.score);
+            }
+        }
+    return best;
+}
+
+/// Same of omaha_score() building and scoring all the 60 hands from scratch
+uint64_t omaha_score_naive(uint64_t common, uint64_t holes)
+{
+    uint64_t best = 0, c[5], h[OMAHA_HOLE_NB];
+
+    for (int i = 0; i < 5; ++i)
+        c[i] = 1ULL << pop_lsb(&common);
+    for (int i = 0; i < OMAHA_HOLE_NB; ++i)
+        h[i] = 1ULL << pop_lsb(&holes);
+
+    for (int i = 0; i < OMAHA_HOLE_NB; ++i)
+        for (int j = i + 1; j < OMAHA_HOLE_NB; ++j)
+            for (int x = 0; x < 5; ++x)
+                for (int y = x + 1; y < 5; ++y)
+                    for (int z = y + 1; z < 5; ++z) {
+                        Hand hand = make_hand(h[i] | h[j] | c[x] | c[y] | c[z]);
+                        hand.do_score();
+                        best = std::max(best, hand.score);
+                    }
+    return best;
+}
+
+/// Initialize an Omaha spot from a string like:
+///
+///  AhAdKsQs [KKxx,AKQJds] - 5h 6h 9c
+///
+Omaha::Omaha(int playersNum, const std::string& pos)
+{
+    Hand all = Hand(), common = Hand();
+    string token, names[PLAYERS_NB];
+    stringstream ss(pos);
+    int n = -1;
+
+    ready = false;
+    if (playersNum < 1 || playersNum > 9)
+        return;
+
+    numPlayers = playersNum;
+    prng = nullptr;
+    std::fill(givenHoles, givenHoles + PLAYERS_NB, 0);
+
+    while (ss >> token && token != "-") {
+        Hand h = Hand();
+        if (++n >= playersNum)
+            return;
+
+        if (parse_cards(token, h, all, OMAHA_HOLE_NB))
+            givenHoles[n] = h.cards;
+        else {
+            auto r = std::make_shared<vector<uint64_t>>();
+            if (!expand_omaha(token, *r))
+                return;
+            ranges[n] = r;
+            names[n] = token;
+        }
+    }
+    while (ss >> token)
+        if (!parse_cards(token, common, all, 5))
+            return;
+
+    givenCommon = common.cards;
+    givenAllMask = all.cards | Deck::Absent;
+
+    // Drop the range's combos with given cards, that can never be dealt
+    for (int i = 0; i <= n; ++i)
+        if (ranges[i]) {
+            auto r = std::make_shared<vector<uint64_t>>();
+            for (uint64_t b : *ranges[i])
+                if (!(b & givenAllMask))
+                    r->push_back(b);
+            if (r->empty())
+                return;
+
+            cout << "Set range " << names[i] << " for player " << i + 1
+                 << " of size: " << r->size() << endl;
+            ranges[i] = r;
+        }
+    ready = true;
+}
+
+/// Score the players' best hands, find the winner and update results. The best
+/// score so far is the floor of the next player, below it scores are not exact
+/// but such a player can neither win nor tie.
+void Omaha::showdown(uint64_t common, const uint64_t holes[], Result results[]) const
+{
+    OmahaBoard b;
+    uint64_t score[PLAYERS_NB], maxScore = 0;
+    unsigned maxId = 0, split = 0;
+
+    b.set(common);
+
+    for (unsigned i = 0; i < numPlayers; ++i) {
+        score[i] = omaha_score(b, holes[i], maxScore);
+        if (maxScore < score[i]) {
+            maxScore = score[i];
+            maxId = i;
+            split = 0;
+        } else if (maxScore == score[i])
+            split++;
+    }
+
+    if (!split)
+        results[maxId].first++;
+    else
+        for (unsigned i = 0; i < numPlayers; ++i)
+            if (score[i] == maxScore)
+                results[i].second += KTie / (split + 1);
+}
+
+/// Deal and play a single game: first the holes out of the ranges, then the
+/// common cards, then the missing hole cards. A range's combo is picked again
+/// while it clashes with the holes already dealt, and when a range keeps
+/// clashing, because the previous players hold the cards it needs, all the
+/// ranges are dealt again. After too many tries, as when the ranges cannot be
+/// dealt together at all, the game is not played.
+void Omaha::run(Result results[])
+{
+    constexpr int MaxPicks = 64, MaxDeals = 16;
+
+    uint64_t allMask, common = givenCommon, holes[PLAYERS_NB];
+    uint64_t n = 0;
+    unsigned bits = 0;
+
+    auto deal_card = [&]() {
+        while (true) {
+            if (bits < 6)
+                n = prng->next(), bits = 64;
+
+            uint64_t b = 1ULL << (n & 0x3F);
+            n >>= 6, bits -= 6;
+            if (!(allMask & b))
+                return allMask |= b, b;
+        }
+    };
+
+    for (int d = 0; ; ++d) {
+        bool dealt = true;
+
+        if (d == MaxDeals)
+            return;
+
+        allMask = givenAllMask;
+        std::copy(givenHoles, givenHoles + numPlayers, holes);
+
+        for (unsigned i = 0; i < numPlayers && dealt; ++i)
+            if (ranges[i]) {
+                const vector<uint64_t>& r = *ranges[i];
+                int picks = 0;
+                do {
+                    uint64_t k = prng->next();
+                    holes[i] = r[((k & 0xFFFFFFFF) * r.size()) >> 32];
+                } while ((holes[i] & allMask) && ++picks < MaxPicks);
+
+                dealt = !(holes[i] & allMask);
+                allMask |= holes[i];
+            }
+
+        if (dealt)
+            break;
+    }
+
+    while (popcount(common) < 5)
+        common |= deal_card();
+
+    for (unsigned i = 0; i < numPlayers; ++i)
+        while (popcount(holes[i]) < OMAHA_HOLE_NB)
+            holes[i] |= deal_card();
+
+    showdown(common, holes, results);
+}
+
+/// Number of the boards of a full enumeration, possible when all the hole cards
+/// are given. Return 0 otherwise.
+size_t Omaha::boards() const
+{
+    for (unsigned i = 0; i < numPlayers; ++i)
+        if (popcount(givenHoles[i]) != OMAHA_HOLE_NB)
+            return 0;
+
+    return binomial(Deck::Size - popcount(givenAllMask & ~Deck::Absent), 5 - popcount(givenCommon));
+}
+
+/// Play the n boards of a full enumeration starting from the first, boards are
+/// the combinations of the missing common cards in lexicographic order.
+void Omaha::run_enumerate(Result results[], size_t first, size_t n) const
+{
+    unsigned k = 5 - popcount(givenCommon);
+    vector<unsigned> cards, idx(k);
+    uint64_t free = ~givenAllMask;
+
+    while (free)
+        cards.push_back(pop_lsb(&free));
+
+    // Unrank the first combination, then walk to the next ones
+    for (unsigned i = 0, c = 0; i < k; ++i, ++c) {
+        while (first >= binomial(cards.size() - c - 1, k - i - 1))
+            first -= binomial(cards.size() - c - 1, k - i - 1), ++c;
+        idx[i] = c;
+    }
+
+    while (n--) {
+        uint64_t common = givenCommon;
+        for (unsigned i : idx)
+            common |= 1ULL << cards[i];
+
+        showdown(common, givenHoles, results);
+
+        int i = k - 1;
+        while (i >= 0 && idx[i] == cards.size() - k + i)
+            --i;
+        if (i < 0)
+            break;
+        ++idx[i];
+        for (unsigned j = i + 1; j < k; ++j)
+            idx[j] = idx[j - 1] + 1;
+    }
+}
+
+/// The boards of k common cards that are canonical under the suit permutations,
+/// sorted by their cards.
+void canonical_boards(unsigned k, vector<uint64_t>& boards)
+{
+    vector<int> group(24);
+    vector<Stratum> sets;
+
+    for (int p = 0; p < 24; ++p)
+        group[p] = p;
+
+    canonical_sets(Deck::Absent, k, group, sets);
+
+    boards.clear();
+    for (const Stratum& s : sets)
+        boards.push_back(s.cards);
+
+    std::sort(boards.begin(), boards.end());
+}
+
+/// The holes that are canonical under the suit permutations leaving the board
+/// unchanged, sorted by their cards. With a canonical board these are the
+/// canonical (hole, board) pairs, see canonical_form().
+void canonical_holes(uint64_t board, vector<uint64_t>& holes)
+{
+    vector<int> stabilizer;
+    vector<unsigned> cards;
+    uint64_t free = ~(board | Deck::Absent);
+
+    for (int p = 0; p < 24; ++p)
+        if (permute(board, p) == board)
+            stabilizer.push_back(p);
+
+    while (free)
+        cards.push_back(pop_lsb(&free));
+
+    holes.clear();
+    for (size_t i = 0; i < cards.size(); ++i)
+        for (size_t j = i + 1; j < cards.size(); ++j) {
+            uint64_t h = (1ULL << cards[i]) | (1ULL << cards[j]), canonical = h;
+            for (int p : stabilizer)
+                canonical = std::min(canonical, permute(h, p));
+            if (canonical == h)
+                holes.push_back(h);
+        }
+
+    std::sort(holes.begin(), holes.end());
+}
+
+/// Map a hole and a board to their canonical form, the smallest board and then
+/// the smallest hole among all the suit permutations of the pair.
+void canonical_form(uint64_t& hole, uint64_t& board)
+{
+    uint64_t h = hole, b = board;
+
+    for (int p = 1; p < 24; ++p) {
+        uint64_t pb = permute(b, p), ph = permute(h, p);
+        if (pb < board || (pb == board && ph < hole))
+            board = pb, hole = ph;
+    }
+}
+
+/// Fill the strength of the given holes on a board of 3, 4 or 5 cards. Work is
+/// shared by all the holes: on each runout every pair of the remaining cards is
+/// scored once and sorted, then the wins and ties of a hole against a random
+/// one are the pairs below and equal to its score, less the ones with any of
+/// its cards, counted per card while walking the sorted pairs.
+void hand_strength(uint64_t board, EhsEntry entries[], size_t n)
+{
+    struct Pair {
+        uint64_t score;
+        unsigned idx;
+        bool operator<(const Pair& p) const { return score < p.score; }
+    };
+
+    unsigned missing = 5 - popcount(board);
+    vector<unsigned> free, avail, idx(missing);
+    vector<Pair> pairs;
+    vector<double> sum(n), sumSq(n);
+    vector<float> equity;
+    unsigned card1[52 * 51 / 2], card2[52 * 51 / 2], pairIdx[64][64];
+
+    for (uint64_t b = ~(board | Deck::Absent); b; )
+        free.push_back(pop_lsb(&b));
+
+    for (size_t e = 0; e < n; ++e) {
+        entries[e].runouts = 0;
+        std::fill(entries[e].histo, entries[e].histo + BINS_NB, 0);
+        entries[e].unused = 0;
+    }
+
+    for (unsigned i = 0; i < missing; ++i)
+        idx[i] = i;
+
+    while (true) {
+        uint64_t runout = 0;
+        for (unsigned i : idx)
+            runout |= 1ULL << free[i];
+
+        Hand common = make_hand(board | runout);
+
+        avail.clear();
+        for (unsigned c : free)
+            if (!(runout & (1ULL << c)))
+                avail.push_back(c);
+
+        // Score all the pairs of the remaining cards
+        pairs.clear();
+        for (size_t i = 0; i < avail.size(); ++i)
+            for (size_t j = i + 1; j < avail.size(); ++j) {
+                unsigned k = unsigned(pairs.size());
+                Hand h = common;
+                h.add(Card(avail[i]), 0);
+                h.add(Card(avail[j]), 0);
+                h.do_score();
+                card1[k] = avail[i], card2[k] = avail[j];
+                pairIdx[avail[i]][avail[j]] = k;
+                pairs.push_back({ h.score, k });
+            }
+
+        std::sort(pairs.begin(), pairs.end());
+        equity.resize(pairs.size());
+
+        // Opponents of a pair are the pairs of the other cards
+        size_t m = avail.size() - 2;
+        float opponents = float(m * (m - 1) / 2);
+        unsigned below = 0, cardBelow[64] = {}, cardEqual[64] = {};
+
+        for (size_t g = 0, end; g < pairs.size(); g = end) {
+            for (end = g; end < pairs.size() && pairs[end].score == pairs[g].score; ++end)
+                cardEqual[card1[pairs[end].idx]]++, cardEqual[card2[pairs[end].idx]]++;
+
+            for (size_t i = g; i < end; ++i) {
+                unsigned k = pairs[i].idx, c1 = card1[k], c2 = card2[k];
+                unsigned wins = below - cardBelow[c1] - cardBelow[c2];
+                unsigned ties = unsigned(end - g) + 1 - cardEqual[c1] - cardEqual[c2];
+                equity[k] = (wins + ties / 2.0f) / opponents;
+            }
+            for (size_t i = g; i < end; ++i) {
+                unsigned k = pairs[i].idx;
+                cardBelow[card1[k]]++, cardBelow[card2[k]]++;
+                cardEqual[card1[k]] = cardEqual[card2[k]] = 0;
+            }
+            below += unsigned(end - g);
+        }
+
+        for (size_t e = 0; e < n; ++e) {
+            uint64_t b = entries[e].hole;
+            if (b & runout)
+                continue;
+
+            unsigned c1 = pop_lsb(&b), c2 = lsb(b);
+            float eq = equity[pairIdx[c1][c2]];
+            sum[e] += eq;
+            sumSq[e] += eq * eq;
+            entries[e].histo[std::min(int(eq * BINS_NB), BINS_NB - 1)]++;
+            entries[e].runouts++;
+        }
+
+        // Next runout in lexicographic order
+        int i = int(missing) - 1;
+        while (i >= 0 && idx[i] == free.size() - missing + i)
+            --i;
+        if (i < 0)
+            break;
+        ++idx[i];
+        for (unsigned j = i + 1; j < missing; ++j)
+            idx[j] = idx[j - 1] + 1;
+    }
+
+    for (size_t e = 0; e < n; ++e) {
+        entries[e].ehs = float(sum[e] / entries[e].runouts);
+        entries[e].ehs2 = float(sumSq[e] / entries[e].runouts);
+    }
+}
@@ -3,20 +3,22 @@
 #define POKER_H_INCLUDED
 
 #include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "util.h"
 
-extern uint64_t ScoreMask[4096];
-extern void init_score_mask();
-
 enum Card : unsigned { INVALID = 13 };
 
 constexpr int PLAYERS_NB = 9;
 constexpr int HOLE_NB    = 2;
+constexpr int OMAHA_HOLE_NB = 4;
 constexpr int MAX_RANGE  = 1 << 9;
+constexpr int BINS_NB    = 10;
+constexpr int MAX_INTERLEAVE = 8;
 
 constexpr uint64_t COMBO_EOF = ~uint64_t(0); // (COMBO_EOF & allMask) is always true
 
@@ -40,6 +42,52 @@ constexpr uint64_t FlushBB         = 1ULL << (16 * 2 + 14);
 constexpr uint64_t StraightBB      = 1ULL << (16 * 2 + 13);
 constexpr uint64_t DoublePairBB    = 1ULL << (16 * 1 + 13);
 
+/// Deck variants as compile-time policies. Cards keep the suit * 16 + value
+/// encoding and a short deck just lacks the values below LowValue, so each
+/// variant has its own constants for the dealer's mask of absent cards, the
+/// scorer's flags and wheel, and its own ScoreMask table. The deck played is
+/// chosen at build time, see 'deck' in the Makefile.
+template<unsigned Low>
+struct DeckBase {
+    static constexpr unsigned LowValue = Low;
+    static constexpr int Size = 4 * (13 - Low);
+    static constexpr uint64_t Absent = FlagsArea | ((1ULL << Low) - 1) * 0x0001000100010001ULL;
+};
+
+struct FullDeck : DeckBase<0> {
+    static constexpr int Index = 0;
+    static constexpr uint64_t FullHouseBB = ::FullHouseBB;
+    static constexpr uint64_t FlushBB = ::FlushBB;
+};
+
+// Short deck from 6 to A: A-6-7-8-9 is a straight and, being harder to make,
+// a flush beats a full house, so their flags are swapped.
+struct ShortDeck : DeckBase<4> {
+    static constexpr int Index = 1;
+    static constexpr uint64_t FullHouseBB = ::FlushBB;
+    static constexpr uint64_t FlushBB = ::FullHouseBB;
+};
+
+#ifdef SHORT_DECK
+typedef ShortDeck Deck;
+#else
+typedef FullDeck Deck;
+#endif
+
+constexpr int DECK_NB = 2;
+
+extern uint64_t ScoreMask[DECK_NB][4096];
+extern uint8_t CategoryOf[DECK_NB][64];
+extern void init_score_mask();
+
+/// True if the card is in the deck played
+inline bool in_deck(unsigned c) { return !(Deck::Absent & (1ULL << c)); }
+
+enum HandCategory {
+    HIGH_CARD, PAIR, TWO_PAIR, TRIPS, STRAIGHT, FLUSH, FULL_HOUSE, QUADS,
+    STRAIGHT_FLUSH, CATEGORY_NB
+};
+
 // Flush detector: a 32 bit integer split in 4 slots (4 bit  each), each one
 // inited at 3, and we add 1 for every card according to card's suit. If one
 // slot reaches 8, then we have a flush.
@@ -88,21 +136,46 @@ struct Hand {
             add(Card(pop_lsb(&v)), 0);
     }
 
+    /// Cheap upper bound of the score computed by do_score() out of the unscored
+    /// hand, when it makes neither a flush nor a straight. In this case do_score()
+    /// only clears bits of the raw score and sets the full house and double pair
+    /// flags, that need a set and two pairs respectively.
+    template<typename D = Deck>
+    uint64_t score_bound() const
+    {
+        return score | (score & Rank3BB ? D::FullHouseBB : 0)
+                     | (more_than_one(score & Rank2BB) ? DoublePairBB : 0);
+    }
+
+    /// True if the unscored hand could make a flush or a straight, so that its
+    /// score is not bounded by score_bound().
+    template<typename D = Deck>
+    bool flush_or_straight() const
+    {
+        uint64_t v = score & Rank1BB;
+        v = (v << 1) | ((v >> 12) << D::LowValue); // Duplicate an ace below the lowest value
+        v &= v >> 1;
+        v &= v >> 1;
+        v &= v >> 2;
+        return v || (suits & IsFlush);
+    }
+
+    template<typename D = Deck>
     void do_score()
     {
         if (suits & IsFlush) {
             unsigned r = lsb(suits & IsFlush) / 4;
-            score = FlushBB | ((cards & RanksBB[r]) >> (16 * r));
+            score = D::FlushBB | ((cards & RanksBB[r]) >> (16 * r));
         }
 
         // Check for a straight
         uint64_t v = score & Rank1BB;
-        v = (v << 1) | (v >> 12); // Duplicate an ace into first position
+        v = (v << 1) | ((v >> 12) << D::LowValue); // Duplicate an ace below the lowest value
         v &= v >> 1;
         v &= v >> 1;
         v &= v >> 2;
         if (v) {
-            auto f = (score & FlushBB) ? StraightFlushBB : StraightBB;
+            auto f = (score & D::FlushBB) ? StraightFlushBB : StraightBB;
             v = 1ULL << msb(v); // Could be more than 1 in case of straight > 5
             score = f | (v << 3) | (v << 2); // At least 2 bits needed by ScoreMask
         }
@@ -113,8 +186,8 @@ struct Hand {
 
         // Mask out the score and get the final one
         unsigned cnt = pop_msb(&v) << 6;
-        v = ScoreMask[cnt + msb(v)];
-        score = (score | FullHouseBB | DoublePairBB) & v;
+        v = ScoreMask[D::Index][cnt + msb(v)];
+        score = (score | D::FullHouseBB | DoublePairBB) & v;
 
         // Drop the lowest cards so that only 5 remains
         cnt = (unsigned(v) >> 13) & 0x7;
@@ -124,13 +197,182 @@ struct Hand {
     }
 };
 
+/// Category of a score computed by Hand::do_score() with deck D. It is given by
+/// the highest bit of the score: the flag of the category or, when there is no
+/// flag, the rank of the best group of cards.
+template<typename D = Deck>
+HandCategory category(uint64_t score)
+{
+    return HandCategory(CategoryOf[D::Index][msb(score)]);
+}
+
+/// Evaluator backends, compile-time policies of Spot::run() and run_incremental().
+/// Both map an unscored hand of 7 cards to the same score, so the results do not
+/// depend on the backend. BitboardEval is Hand::do_score(), TableEval looks the
+/// score up in tables built by init(): a flush by the ranks of its suit, else
+/// the ranks' multiset by the sum of per rank keys, unique for 7 cards, that is
+/// computed out of the rows of the unscored score. Their prefetch() loads ahead
+/// the table entry that score() will read, for Spot::run_interleaved().
+struct BitboardEval {
+    static void score(Hand& h) { h.do_score(); }
+    static size_t memory() { return sizeof(ScoreMask[0]); }
+
+    // Entry of ScoreMask, exact when the hand is neither a flush nor a straight
+    static void prefetch(const Hand& h)
+    {
+        uint64_t v = (h.score ^ (h.score >> 16)) & ~FlagsArea;
+        unsigned cnt = pop_msb(&v) << 6;
+        ::prefetch(&ScoreMask[Deck::Index][cnt + msb(v)]);
+    }
+};
+
+struct TableEval {
+    static uint32_t Keys[8192];       // Sum of the keys of a set of ranks
+    static uint16_t Flushes[8192];    // Class of a flush by its ranks
+    static std::vector<uint16_t> Classes; // Class of the ranks' multiset by its key
+    static std::vector<uint64_t> Scores;  // Score of a class
+
+    static void init();
+    static size_t memory();
+
+    // Entry of Classes, that is too big to stay in cache
+    static void prefetch(const Hand& h)
+    {
+        ::prefetch(&Classes[key(h)]);
+    }
+
+    static uint32_t key(const Hand& h)
+    {
+        return  Keys[h.score & 0x1FFF] + Keys[(h.score >> 16) & 0x1FFF]
+              + Keys[(h.score >> 32) & 0x1FFF] + Keys[h.score >> 48];
+    }
+
+    static void score(Hand& h)
+    {
+        if (h.suits & IsFlush) {
+            unsigned r = lsb(h.suits & IsFlush) / 4;
+            h.score = Scores[Flushes[(h.cards >> (16 * r)) & 0x1FFF]];
+            return;
+        }
+        h.score = Scores[Classes[key(h)]];
+    }
+};
+
+enum Mode {
+    MONTECARLO = 0, ENUMERATE = 1, STREETS = 2, MATRIX = 4, COMPARE = 8,
+    ESTIMATE = 16, STRATIFIED = 32, ANTITHETIC = 64, VS_RANDOM = 128, RUNOUTS = 256,
+    OMAHA = 512, HAND_STRENGTH = 1024, TABLE_EVAL = 2048, CATEGORIES = 4096,
+    SPOTS = 8192
+};
+
+/// Equity trajectories collected by Spot::run_streets(). For the flop and the
+/// turn we store the sum of the players' equities and their distribution.
+struct Streets {
+    uint64_t games[2];
+    double equity[2][PLAYERS_NB];
+    uint64_t histo[2][PLAYERS_NB][BINS_NB];
+};
+
+/// Per player hand categories at showdown collected by Spot::run_categories():
+/// the games finished with each category and the pots won and tied with it.
+struct Categories {
+    uint64_t made[PLAYERS_NB][CATEGORY_NB];
+    Result won[PLAYERS_NB][CATEGORY_NB];
+};
+
+/// Per combo results of a hero's range collected by Spot::run_matrix()
+struct Matrix {
+    std::vector<Hand> combos;
+    std::vector<Result> results;
+    std::vector<uint64_t> games;
+};
+
+/// Counters of the spot with each of the given boards, collected by run() in
+/// RUNOUTS mode. Each board is enumerated exactly, or with games set plays
+/// that many Monte Carlo games. Results of board k start at results[k * PLAYERS_NB].
+struct Runouts {
+    std::vector<uint64_t> boards;
+    std::vector<Result> results;
+    size_t games = 0;
+};
+
+/// Strength of a hole on a board, both suit-canonical, as stored in the tables
+/// written by the ehs command: the equity against a random hole averaged over
+/// the runouts (EHS), the mean of its square (EHS2) and the histogram of the
+/// equity on the river in BINS_NB bins. Layout is fixed, the tables are mapped
+/// from disk as arrays of entries.
+struct EhsEntry {
+    uint64_t hole;
+    float ehs, ehs2;
+    uint16_t runouts;
+    uint16_t histo[BINS_NB];
+    uint16_t unused;
+};
+
+/// Canonical holes and their strength on a batch of canonical boards, filled
+/// by run() in HAND_STRENGTH mode. Entries of board k, with their holes set by
+/// the caller, are the ones in [first[k], first[k + 1]).
+struct HandStrength {
+    std::vector<uint64_t> boards;
+    std::vector<size_t> first;
+    std::vector<EhsEntry> entries;
+};
+
+/// A stratum of the stratified estimator: the first common cards to be dealt
+/// and their probability.
+struct Stratum {
+    uint64_t cards;
+    double weight;
+};
+
+/// Per player equity estimate and its variance, collected by the estimators
+/// selected with -m. Plain and antithetic sampling store the sums of the per
+/// sample equities, stratified sampling directly the weighted means.
+struct Estimate {
+    std::vector<int> perms;      // Suit permutations of antithetic sampling
+    std::vector<Stratum> strata; // Strata of stratified sampling
+    std::vector<std::vector<int>> strataPerms; // Same, for each stratum
+    uint64_t samples;
+    double sum[PLAYERS_NB], sumSq[PLAYERS_NB];
+    double mean[PLAYERS_NB], var[PLAYERS_NB];
+};
+
+/// The combos of a player's range, stored once per query as a structure of
+/// arrays sized to the range, each array starting at a cache line, and shared
+/// read-only by all the copies of a Spot. Ranges are sampled with 9 random
+/// bits, pick[] maps them to the index of a combo, as if the range was copied
+/// MAX_RANGE / size times, or to the sentinel at index size, whose cards clash
+/// with any dealt card so that the pick is discarded.
+class Range {
+
+    char* mem;
+
+public:
+    Range(const std::vector<Hand>& hands, const std::string& tk);
+    ~Range() { free(mem); }
+    Range(const Range&) = delete;
+    Range& operator=(const Range&) = delete;
+
+    Hand operator[](size_t i) const { return { scores[i], cards[i], suits[i] }; }
+
+    size_t size;
+    const uint64_t* scores;
+    const uint64_t* cards;
+    const uint32_t* suits;
+    uint16_t pick[MAX_RANGE];
+    std::string token; // As given by the user
+};
+
 class Spot {
 
-    Hand combos[PLAYERS_NB][MAX_RANGE];
+    std::shared_ptr<const Range> ranges[PLAYERS_NB];
     int combosId[PLAYERS_NB + 1];
     int missingHolesId[PLAYERS_NB * HOLE_NB + 1];
     Hand givenHoles[PLAYERS_NB];
     Hand givenCommon;
+    Hand streets[6][PLAYERS_NB];
+    Hand boards[6];
+    uint64_t lastRanges, lastCommons, lastHoles;
 
     PRNG* prng;
     unsigned numPlayers;
@@ -138,25 +380,165 @@ class Spot {
     uint32_t enumMask;
     uint32_t rangeMask;
     uint64_t givenAllMask;
+    uint64_t deadCards;
     bool ready;
 
     void enumerate(std::vector<uint64_t>& enumBuf, unsigned missing,
-                   uint64_t rnd64[], int shifts[], int limit,
-                   size_t idx, size_t threadsNum);
+                   uint64_t rnd64[], int shifts[], int limit);
     bool parse_range(const std::string& token, int player);
+    void print_range(int player) const;
+    uint64_t deal_ranges(uint64_t allMask);
+    void deal(Hand hands[], Hand& common);
+    void deal_incremental(Hand hands[], Hand& common);
+    template<typename E = BitboardEval>
+    void showdown(Hand hands[], Result results[]) const;
+    template<typename E>
+    void showdown_categories(Hand hands[], Result results[], Categories& ct) const;
+    size_t enumerate_board(const Hand hands[], unsigned missing, uint64_t dead,
+                           unsigned limit, Result results[]) const;
+    void symmetries(std::vector<int>& group, std::vector<int>& cosets,
+                    std::vector<int>& closed, uint64_t common = 0) const;
+    bool strata(const std::vector<int>& group, std::vector<Stratum>& out) const;
 
 public:
     Spot() = default;
     explicit Spot(int playersNum, const std::string& pos);
-    void run(Result results[]);
-    size_t set_enumerate(std::vector<uint64_t>&, size_t, size_t);
+    template<typename E = BitboardEval> void run(Result results[]);
+    template<typename E = BitboardEval> void run_incremental(Result results[]);
+    template<typename E = BitboardEval>
+    void run_interleaved(Result results[], unsigned k, bool enumerated);
+    template<typename E = BitboardEval>
+    void run_categories(Result results[], Categories& ct, bool enumerated);
+    void run_streets(Result results[], Streets& st);
+    void run_matrix(Matrix& mx, bool enumerated);
+    void run_estimate(Result results[], Estimate& e);
+    void run_runout(Result results[], uint64_t k, size_t games);
+    size_t set_enumerate(std::vector<uint64_t>& enumBuf, bool verbose = true);
+    bool set_estimate(Mode mode, Estimate& e) const;
+    bool set_common(uint64_t cards);
+    bool set_dead(uint64_t cards);
+    bool vs_random() const;
+    bool enumerable() const;
+    bool complete() const;
+    bool flops(std::vector<Stratum>& out, std::vector<double>& deals) const;
+    size_t runouts() const;
+    void print_ranges() const;
 
     bool valid() const { return ready; }
     uint64_t eval() const { return givenCommon.score; }
+    uint64_t common() const { return givenCommon.cards; }
+    uint64_t holes(size_t p) const { return givenHoles[p].cards; }
+    size_t players() const { return numPlayers; }
+    void set_prng(PRNG* p) { prng = p; }
+};
+
+/// A batch of independent spots, like the all-ins of a hand history, played by
+/// run() in SPOTS mode. Each spot is a chunk of work played by a single thread,
+/// enumerated exactly when games[k] is 0, else by games[k] Monte Carlo games.
+/// Results of spot k start at results[k * PLAYERS_NB].
+struct Batch {
+    std::vector<Spot> spots;
+    std::vector<size_t> games;
+    std::vector<Result> results;
+};
+
+/// The 10 sets of 3 common cards out of a complete board, shared by all the
+/// players when scoring an Omaha showdown.
+struct OmahaBoard {
+    Hand triples[10];
+    void set(uint64_t common);
+};
+
+/// A Pot-Limit Omaha spot. Each player has 4 hole cards, given, partially given
+/// or out of a range, and the best hand uses exactly 2 of them and 3 common
+/// cards. Ranges are lists of 4 cards combos shared by all the copies.
+class Omaha {
+
+    std::shared_ptr<const std::vector<uint64_t>> ranges[PLAYERS_NB];
+    uint64_t givenHoles[PLAYERS_NB];
+    uint64_t givenCommon;
+    uint64_t givenAllMask;
+    unsigned numPlayers;
+    PRNG* prng;
+    bool ready;
+
+    void showdown(uint64_t common, const uint64_t holes[], Result results[]) const;
+
+public:
+    Omaha() = default;
+    explicit Omaha(int playersNum, const std::string& pos);
+    void run(Result results[]);
+    void run_enumerate(Result results[], size_t first, size_t n) const;
+    size_t boards() const;
+
+    bool valid() const { return ready; }
     size_t players() const { return numPlayers; }
     void set_prng(PRNG* p) { prng = p; }
 };
 
-extern void run(const Spot& s, size_t games, size_t threads, bool enumerate, Result results[]);
+/// Statistics of the first player's equity in a list of spots evaluated with
+/// common random numbers by run(). For each spot we store sum and sum of
+/// squares of the per game equity, and of its difference with the first spot.
+struct Compare {
+    std::vector<Spot> spots;
+    std::vector<double> sum, sumSq, diff, diffSq;
+    uint64_t games;
+};
+
+/// Periodic checkpoints of a long run. Every interval seconds run() saves in
+/// file the arguments of the run, the first chunk of work not yet handed out,
+/// the chunks in progress and the counters of all the completed chunks. A run
+/// resumed from there plays again the chunks in progress, then continues.
+struct Checkpoint {
+    std::string file;
+    std::string cmd;
+    unsigned interval;
+    bool resumed = false;
+    uint64_t next;
+    std::vector<uint64_t> pending;
+    Result results[PLAYERS_NB];
+};
+
+/// Optional outputs of run(), collected according to the mode
+struct Outputs {
+    Streets* streets = nullptr;
+    Matrix* matrix = nullptr;
+    Compare* compare = nullptr;
+    Estimate* estimate = nullptr;
+    Checkpoint* checkpoint = nullptr;
+    Runouts* runouts = nullptr;
+    const Omaha* omaha = nullptr;
+    HandStrength* strength = nullptr;
+    Categories* categories = nullptr;
+    Batch* batch = nullptr;
+    unsigned interleave = 1; // Games played together by run_interleaved()
+};
+
+/// Slice of the work covered by one of the processes a run is split into with
+/// --shard. Shard idx of num plays the chunks of work k with k % num == idx.
+struct Shard {
+    size_t idx = 0;
+    size_t num = 1;
+};
+
+/// Policies to bind the threads of run() to the logical CPUs
+enum Binding { NO_BINDING, COMPACT, SCATTER, CORES };
+
+extern bool parse_combos(const std::string& token, std::vector<Hand>& combos);
+extern int define_range(const std::string& name, const std::string& token);
+extern unsigned ranges_generation();
+extern void run(const Spot& s, size_t games, size_t threads, Mode mode,
+                Result results[], const Outputs& out = Outputs(),
+                const Shard& shard = Shard(), Binding binding = NO_BINDING);
+extern void run(size_t players, size_t games, size_t threads, Mode mode,
+                Result results[], const Outputs& out = Outputs(),
+                const Shard& shard = Shard(), Binding binding = NO_BINDING);
+extern size_t physical_cores();
+extern uint64_t omaha_score(const OmahaBoard& b, uint64_t holes, uint64_t floor = 0);
+extern uint64_t omaha_score_naive(uint64_t common, uint64_t holes);
+extern void canonical_boards(unsigned k, std::vector<uint64_t>& boards);
+extern void canonical_holes(uint64_t board, std::vector<uint64_t>& holes);
+extern void canonical_form(uint64_t& hole, uint64_t& board);
+extern void hand_strength(uint64_t board, EhsEntry entries[], size_t n);
 
 #endif // #ifndef POKER_H_INCLUDED
@@ -1,11 +1,35 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <thread>
+#include <tuple>
 #include <vector>
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
 #include "poker.h"
 #include "util.h"
 
@@ -14,56 +38,572 @@ using namespace std;
 /// ScoreMask contains 1248 masks for each combination of 2 cards c1, c2 in range
 /// [0..63] with c1 > c2 and with c1, c2 of different face value (2,3..K,A).
 /// ScoreMask is indexed by (c1 << 6) + c2. ScoreMask bitwise AND the hand score
-/// to "fix" it for some special cases.
-uint64_t ScoreMask[4096];
+/// to "fix" it for some special cases. Each deck has its own table.
+uint64_t ScoreMask[DECK_NB][4096];
+
+/// CategoryOf is indexed by the highest bit of a score and gives its category
+uint8_t CategoryOf[DECK_NB][64];
 
 namespace {
 
+// Games played by a thread each time it takes a chunk of work
+constexpr size_t ChunkGames = 1 << 14;
+
+constexpr size_t CacheLineSize = 64;
+
+constexpr uint64_t NoChunk = ~uint64_t(0);
+
+/// The work of a run is split in chunks of ChunkGames games, or in one chunk
+/// per stratum with stratified sampling, handed out on demand to the threads.
+/// Chunk k is played with the PRNG seeded by k, or with the games starting at
+/// k * ChunkGames in the enumeration buffer, so results depend neither on the
+/// thread that plays a chunk nor on the number of threads.
+struct Work {
+    std::mutex mutex;
+    std::vector<uint64_t> redo; // Chunks not completed at the last checkpoint
+    uint64_t next, end, step;
+    size_t gamesNum;
+    const uint64_t* enumBuf;
+    size_t entries; // Entries of enumBuf for a single game
+    size_t parts;   // Chunks of each runout with VS_RANDOM
+};
+
+/// Thread objects are allocated aligned to a cache line and their counters,
+/// updated at every game, start at a cache line boundary, so that threads
+/// never write to the same cache line.
 class Thread {
 
-    size_t idx;
+    alignas(CacheLineSize) Result results[PLAYERS_NB];
     PRNG prng;
     Spot spot;
-    size_t gamesNum;
-    std::thread* th;
-    Result results[PLAYERS_NB];
-    std::vector<uint64_t> enumBuf;
+    Work* work;
+    uint64_t chunk;
+    Result saved[PLAYERS_NB]; // Counters of the completed chunks
+    Streets streets;
+    Categories categories;
+    Matrix matrix;
+    Compare compare;
+    Estimate estimate;
+    const std::vector<Stratum>* strata;
+    Runouts* runouts;
+    Omaha omaha;
+    HandStrength* strength;
+    Batch* batch;
+    unsigned interleave;
+
+    bool next_chunk();
+    void run_compare();
+    void run_stratified();
+    void run_runouts();
+    void run_batch();
+    void run_interleaved(Mode mode, size_t n);
 
 public:
+    // Over-aligned new is not available before C++17, so allocate some more
+    // memory, align by hand and store the original pointer just before.
+    static void* operator new(size_t size)
+    {
+        char* mem = static_cast<char*>(malloc(size + CacheLineSize));
+        char* p = mem + CacheLineSize - uintptr_t(mem) % CacheLineSize;
+        reinterpret_cast<char**>(p)[-1] = mem;
+        return p;
+    }
+
+    static void operator delete(void* p)
+    {
+        free(static_cast<char**>(p)[-1]);
+    }
+
     Result result(size_t p) const { return results[p]; }
+    const Streets& street_results() const { return streets; }
+    const Categories& category_results() const { return categories; }
+    const Matrix& matrix_results() const { return matrix; }
+    const Compare& compare_results() const { return compare; }
+    const Estimate& estimate_results() const { return estimate; }
 
-    Thread(size_t id, const Spot& s, size_t n, size_t threadsNum, bool enumerate)
-        : idx(id)
-        , prng(id)
+    // Accessed by checkpoints while the thread is running, under work->mutex
+    Result saved_result(size_t p) const { return saved[p]; }
+    uint64_t current_chunk() const { return chunk; }
+
+    Thread(const Spot& s, const Outputs& out, Work* w)
+        : prng(0)
         , spot(s)
-        , gamesNum(n)
+        , work(w)
+        , chunk(NoChunk)
+        , strata(nullptr)
+        , runouts(out.runouts)
+        , strength(out.strength)
+        , batch(out.batch)
+        , interleave(std::min(std::max(out.interleave, 1U), unsigned(MAX_INTERLEAVE)))
     {
         memset(results, 0, sizeof(results));
+        std::fill(saved, saved + PLAYERS_NB, Result());
+        memset(&streets, 0, sizeof(streets));
+        categories = Categories();
         spot.set_prng(&prng);
 
-        // Launch a thread that will call immediately Thread::run()
-        th = new std::thread(&Thread::run, this, enumerate, threadsNum);
+        if (out.matrix) {
+            matrix.combos = out.matrix->combos;
+            matrix.results.resize(matrix.combos.size());
+            matrix.games.resize(matrix.combos.size());
+        }
+        if (out.compare) {
+            const Compare* cmp = out.compare;
+            compare.spots = cmp->spots;
+            compare.sum.resize(cmp->spots.size());
+            compare.sumSq = compare.diff = compare.diffSq = compare.sum;
+            compare.games = 0;
+            for (Spot& sp : compare.spots)
+                sp.set_prng(&prng);
+        }
+        if (out.estimate) {
+            estimate.perms = out.estimate->perms;
+            estimate.strataPerms = out.estimate->strataPerms;
+            estimate.samples = 0;
+            memset(estimate.sum, 0, sizeof(estimate.sum));
+            memset(estimate.sumSq, 0, sizeof(estimate.sumSq));
+            memset(estimate.mean, 0, sizeof(estimate.mean));
+            memset(estimate.var, 0, sizeof(estimate.var));
+            strata = &out.estimate->strata;
+        }
+        if (out.omaha) {
+            omaha = *out.omaha;
+            omaha.set_prng(&prng);
+        }
     }
 
-    void join()
+    void run(Mode mode)
     {
-        th->join();
-        delete th;
+        if (mode & STRATIFIED) {
+            run_stratified();
+            return;
+        }
+
+        if (mode & RUNOUTS) {
+            run_runouts();
+            return;
+        }
+
+        if (mode & SPOTS) {
+            run_batch();
+            return;
+        }
+
+        // Each chunk is a board of the batch
+        if (mode & HAND_STRENGTH) {
+            while (next_chunk()) {
+                size_t first = strength->first[chunk];
+                hand_strength(strength->boards[chunk], &strength->entries[first],
+                              strength->first[chunk + 1] - first);
+            }
+            return;
+        }
+
+        // Against random opponents gamesNum are the games of each runout, and
+        // chunk k plays part k % parts of runout k / parts.
+        if (mode & VS_RANDOM) {
+            while (next_chunk()) {
+                size_t first = chunk % work->parts * ChunkGames;
+                prng.seed(chunk);
+                spot.run_runout(results, chunk / work->parts,
+                                std::min(ChunkGames, work->gamesNum - first));
+            }
+            return;
+        }
+
+        while (next_chunk()) {
+            size_t first = chunk * ChunkGames;
+            size_t n = std::min(ChunkGames, work->gamesNum - first);
+
+            if (mode & OMAHA) {
+                if (mode & ENUMERATE)
+                    omaha.run_enumerate(results, first, n);
+                else {
+                    prng.seed(chunk);
+                    for (size_t i = 0; i < n; i++)
+                        omaha.run(results);
+                }
+                continue;
+            }
+
+            if (mode & ENUMERATE)
+                prng.set_enum_buffer(work->enumBuf + first * work->entries);
+            else
+                prng.seed(chunk);
+
+            if (mode & MATRIX)
+                for (size_t i = 0; i < n; i++)
+                    spot.run_matrix(matrix, mode & ENUMERATE);
+
+            else if ((mode & CATEGORIES) && (mode & TABLE_EVAL))
+                for (size_t i = 0; i < n; i++)
+                    spot.run_categories<TableEval>(results, categories, mode & ENUMERATE);
+
+            else if (mode & CATEGORIES)
+                for (size_t i = 0; i < n; i++)
+                    spot.run_categories(results, categories, mode & ENUMERATE);
+
+            else if (interleave > 1 && !(mode & (STREETS | COMPARE | ESTIMATE | ANTITHETIC)))
+                run_interleaved(mode, n);
+
+            else if ((mode & ENUMERATE) && (mode & TABLE_EVAL))
+                for (size_t i = 0; i < n; i++)
+                    spot.run_incremental<TableEval>(results);
+
+            else if (mode & ENUMERATE)
+                for (size_t i = 0; i < n; i++)
+                    spot.run_incremental(results);
+
+            else if (mode & STREETS)
+                for (size_t i = 0; i < n; i++)
+                    spot.run_streets(results, streets);
+
+            else if (mode & COMPARE)
+                for (size_t i = 0; i < n; i++)
+                    run_compare();
+
+            else if (mode & (ESTIMATE | ANTITHETIC))
+                for (size_t i = 0; i < n; i++)
+                    spot.run_estimate(results, estimate);
+
+            else if (mode & TABLE_EVAL)
+                for (size_t i = 0; i < n; i++)
+                    spot.run<TableEval>(results);
+            else
+                for (size_t i = 0; i < n; i++)
+                    spot.run(results);
+        }
     }
+};
+
+/// Mark the current chunk as completed, saving the counters for the next
+/// checkpoint, and take a new one. Return false when there is no more work.
+bool Thread::next_chunk()
+{
+    std::lock_guard<std::mutex> lock(work->mutex);
+
+    if (chunk != NoChunk)
+        std::copy(results, results + PLAYERS_NB, saved);
+
+    if (work->redo.size()) {
+        chunk = work->redo.back();
+        work->redo.pop_back();
+    } else if (work->next < work->end) {
+        chunk = work->next;
+        work->next += work->step;
+    } else
+        chunk = NoChunk;
+
+    return chunk != NoChunk;
+}
 
-    void run(bool enumerate, size_t threadsNum)
+// Save the checkpoint in a temporary file first, then rename it, so that a run
+// killed while saving leaves the previous checkpoint untouched. Counters are
+// the ones of the completed chunks, chunks in progress will be played again.
+void save_checkpoint(Checkpoint& cp, Work& work, const std::vector<Thread*>& threads,
+                     const Result base[])
+{
     {
-        if (enumerate) {
-            gamesNum = spot.set_enumerate(enumBuf, idx, threadsNum);
-            if (!gamesNum)
-                return;
-            prng.set_enum_buffer(enumBuf.data());
+        std::lock_guard<std::mutex> lock(work.mutex);
+
+        cp.next = work.next;
+        cp.pending = work.redo;
+        std::copy(base, base + PLAYERS_NB, cp.results);
+
+        for (const Thread* th : threads) {
+            if (!th) // Not started yet
+                continue;
+
+            if (th->current_chunk() != NoChunk)
+                cp.pending.push_back(th->current_chunk());
+
+            for (int p = 0; p < PLAYERS_NB; ++p) {
+                cp.results[p].first += th->saved_result(p).first;
+                cp.results[p].second += th->saved_result(p).second;
+            }
         }
-        for (size_t i = 0; i < gamesNum; i++)
-            spot.run(results);
     }
+    string tmp = cp.file + ".tmp";
+    ofstream f(tmp);
+
+    f << "checkpoint 3"
+      << "\ncmd " << cp.cmd
+      << "\ninterval " << cp.interval
+      << "\nnext " << cp.next
+      << "\npending " << cp.pending.size();
+
+    for (uint64_t k : cp.pending)
+        f << " " << k;
+
+    f << "\nresults";
+    for (int p = 0; p < PLAYERS_NB; ++p)
+        f << " " << cp.results[p].first << " " << cp.results[p].second;
+    f << "\n";
+    f.close();
+
+    if (!f || std::rename(tmp.c_str(), cp.file.c_str()))
+        cerr << "Cannot write checkpoint file: " << cp.file << endl;
+}
+
+/// Play a game for each spot, restarting the PRNG from the same state, so that
+/// all the spots see the same stream of random numbers. When the spots differ
+/// only in the first player's cards, boards and opponents' hands are the same
+/// in most of the games and equity differences have a much lower variance.
+void Thread::run_compare()
+{
+    PRNG start = prng;
+    double x0 = 0;
+
+    for (size_t k = 0; k < compare.spots.size(); ++k) {
+        Result r[PLAYERS_NB] = {};
+        prng = start;
+        compare.spots[k].run(r);
+
+        double x = (KTie * r[0].first + r[0].second) / double(KTie);
+        compare.sum[k] += x;
+        compare.sumSq[k] += x * x;
+
+        if (!k)
+            x0 = x;
+        else {
+            compare.diff[k] += x - x0;
+            compare.diffSq[k] += (x - x0) * (x - x0);
+        }
+    }
+    compare.games++;
+}
+
+/// Stratified sampling: games are allocated to the strata in proportion to
+/// their weight, at least 2 per stratum to estimate its variance, and each
+/// stratum is a chunk of work. The estimate is the weighted mean of the
+/// strata's means, with variance the weighted sum of their mean's variances.
+void Thread::run_stratified()
+{
+    uint64_t common = spot.common();
+    double cumWeight = 0;
+    std::vector<size_t> bounds(1); // Cumulative games allocated to the strata
+
+    for (const Stratum& s : *strata)
+        bounds.push_back(size_t(work->gamesNum * (cumWeight += s.weight)));
+
+    while (next_chunk()) {
+        const Stratum& s = (*strata)[chunk];
+        size_t n = std::max(bounds[chunk + 1] - bounds[chunk], size_t(2));
+
+        prng.seed(chunk);
+
+        Estimate e;
+        e.perms = estimate.strataPerms.empty() ? estimate.perms : estimate.strataPerms[chunk];
+        e.samples = 0;
+        memset(e.sum, 0, sizeof(e.sum));
+        memset(e.sumSq, 0, sizeof(e.sumSq));
+
+        spot.set_common(common | s.cards);
+
+        for (size_t i = 0; i < n; i++)
+            spot.run_estimate(results, e);
+
+        for (size_t p = 0; p < spot.players(); ++p) {
+            double mean = e.sum[p] / n;
+            double var = (e.sumSq[p] - e.sum[p] * mean) / (n - 1);
+            estimate.mean[p] += s.weight * mean;
+            estimate.var[p] += s.weight * s.weight * std::max(var, 0.0) / n;
+        }
+        estimate.samples += n;
+    }
+    spot.set_common(common);
+}
+
+/// Runouts: each board is a chunk of work, where we enumerate the hole cards,
+/// ranges and missing common cards of the spot with that board, or play the
+/// single game when they are all given. With runouts->games set we play that
+/// many games instead, seeded by the board. Counters go both to the board's
+/// slot and to the totals.
+void Thread::run_runouts()
+{
+    uint64_t common = spot.common();
+    std::vector<uint64_t> buf;
+
+    while (next_chunk()) {
+        Result r[PLAYERS_NB] = {};
+
+        spot.set_common(runouts->boards[chunk]);
+
+        if (runouts->games) {
+            prng.seed(runouts->boards[chunk]);
+            for (size_t i = 0; i < runouts->games; i++)
+                spot.run(r);
+        } else {
+            size_t n = spot.set_enumerate(buf, false);
+            prng.set_enum_buffer(buf.data());
+
+            for (size_t i = 0; i < n; i++)
+                spot.run_incremental(r);
+
+            // Nothing to enumerate is either a complete spot, played once,
+            // or a range left with no dealable combo, with no games at all.
+            if (!n && spot.complete())
+                spot.run(r);
+
+            prng.set_enum_buffer(nullptr);
+        }
+
+        for (size_t p = 0; p < spot.players(); ++p) {
+            runouts->results[chunk * PLAYERS_NB + p] = r[p];
+            results[p].first += r[p].first;
+            results[p].second += r[p].second;
+        }
+    }
+    spot.set_common(common);
+}
+
+/// Plain Monte Carlo or full enumeration of n games, played interleave games at
+/// a time. The games are the same of the single game loop, and so the results.
+void Thread::run_interleaved(Mode mode, size_t n)
+{
+    for (size_t i = 0; i < n; i += interleave) {
+        unsigned k = unsigned(std::min(n - i, size_t(interleave)));
+
+        if (mode & TABLE_EVAL)
+            spot.run_interleaved<TableEval>(results, k, mode & ENUMERATE);
+        else
+            spot.run_interleaved(results, k, mode & ENUMERATE);
+    }
+}
+
+/// Batch: each spot is a chunk of work, played by this thread alone. Spots are
+/// small and many, so this scales better than splitting each one among the
+/// threads. Monte Carlo games are seeded by the spot's index in the batch.
+void Thread::run_batch()
+{
+    std::vector<uint64_t> buf;
+
+    while (next_chunk()) {
+        Spot& s = batch->spots[chunk];
+        Result* r = &batch->results[chunk * PLAYERS_NB];
+
+        s.set_prng(&prng);
+
+        if (batch->games[chunk]) {
+            prng.seed(chunk);
+            for (size_t i = 0; i < batch->games[chunk]; i++)
+                s.run(r);
+        } else {
+            size_t n = s.set_enumerate(buf, false);
+            prng.set_enum_buffer(buf.data());
+
+            for (size_t i = 0; i < n; i++)
+                s.run_incremental(r);
+
+            if (!n && s.complete()) // As in run_runouts()
+                s.run(r);
+
+            prng.set_enum_buffer(nullptr);
+        }
+    }
+}
+
+/// A logical CPU, with the physical core and the package it belongs to
+struct Cpu {
+    int id, package, core;
 };
 
+/// Logical CPUs the process is allowed to run on, read from sysfs on Linux.
+/// Elsewhere every logical CPU is assumed to be a physical core.
+std::vector<Cpu> cpu_topology()
+{
+    std::vector<Cpu> cpus;
+
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (!sched_getaffinity(0, sizeof(set), &set))
+        for (int c = 0; c < CPU_SETSIZE; ++c) {
+            if (!CPU_ISSET(c, &set))
+                continue;
+
+            string path = "/sys/devices/system/cpu/cpu" + to_string(c) + "/topology/";
+            ifstream pkg(path + "physical_package_id"), core(path + "core_id");
+            Cpu cpu = { c, 0, c };
+            if (pkg && core)
+                pkg >> cpu.package, core >> cpu.core;
+            cpus.push_back(cpu);
+        }
+#endif
+
+    if (cpus.empty())
+        for (int c = 0; c < int(std::max(std::thread::hardware_concurrency(), 1U)); ++c)
+            cpus.push_back({ c, 0, c });
+
+    return cpus;
+}
+
+/// Order in which the logical CPUs are assigned to the threads, the i-th
+/// thread runs on CPU order[i % order.size()].
+///
+/// - COMPACT: fill a core with all its SMT siblings, then the next core of the
+///   same package, then the next package.
+///
+/// - SCATTER: one CPU per core, alternating packages, then the SMT siblings
+///   in the same order when all the cores are taken.
+///
+/// - CORES: only one CPU per physical core, SMT siblings are never used.
+///
+std::vector<int> binding_order(Binding binding)
+{
+    struct Slot {
+        int smt, core, package, id;
+        bool operator<(const Slot& s) const {
+            return std::tie(smt, core, package, id) < std::tie(s.smt, s.core, s.package, s.id);
+        }
+    };
+    std::vector<Cpu> cpus = cpu_topology();
+    std::vector<Slot> slots;
+    std::vector<int> order;
+
+    // Sort by package and core, then rank the SMT siblings of each core and
+    // the cores of each package.
+    std::sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) {
+        return std::tie(a.package, a.core, a.id) < std::tie(b.package, b.core, b.id);
+    });
+
+    for (size_t i = 0, smt = 0, core = 0; i < cpus.size(); ++i) {
+        if (i && cpus[i].package != cpus[i - 1].package)
+            smt = core = 0;
+        else if (i && cpus[i].core != cpus[i - 1].core)
+            smt = 0, core++;
+        else if (i)
+            smt++;
+        slots.push_back({ int(smt), int(core), cpus[i].package, cpus[i].id });
+    }
+
+    if (binding == SCATTER || binding == CORES)
+        std::sort(slots.begin(), slots.end());
+
+    for (const Slot& s : slots)
+        if (binding != CORES || !s.smt)
+            order.push_back(s.id);
+
+    return order;
+}
+
+/// Bind the calling thread to a logical CPU
+void bind_this_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+    if (cpu < 64)
+        SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+#else
+    (void)cpu;
+#endif
+}
+
 // Helpers used by init_score_mask()
 constexpr uint64_t set_counter(unsigned n)
 {
@@ -81,32 +621,350 @@ uint64_t clear_before(uint64_t b)
 
 } // namespace
 
+/// Map a whole file read-only in memory, pages are loaded on first access and
+/// shared among processes. Elsewhere than on Linux the file is read in a buffer.
+/// Return nullptr on failure.
+const void* map_file(const std::string& file, size_t& size)
+{
+#if defined(__linux__)
+    int fd = open(file.c_str(), O_RDONLY);
+    struct stat st;
+
+    if (fd < 0)
+        return nullptr;
+
+    void* p = fstat(fd, &st) || !st.st_size ? MAP_FAILED
+            : mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    size = size_t(st.st_size);
+    return p == MAP_FAILED ? nullptr : p;
+#else
+    ifstream f(file, ios::binary | ios::ate);
+    if (!f || !(size = size_t(f.tellg())))
+        return nullptr;
+
+    char* p = static_cast<char*>(malloc(size));
+    f.seekg(0);
+    if (!f.read(p, size)) {
+        free(p);
+        return nullptr;
+    }
+    return p;
+#endif
+}
+
+void unmap_file(const void* p, size_t size)
+{
+#if defined(__linux__)
+    munmap(const_cast<void*>(p), size);
+#else
+    (void)size;
+    free(const_cast<void*>(p));
+#endif
+}
+
+bool PerfCounters::start()
+{
+#if defined(__linux__)
+    const uint64_t config[] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS };
+
+    for (int i = 0; i < 2; ++i) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config[i];
+        attr.disabled = 1;
+        attr.inherit = 1; // Count also the threads started later
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    if (fd[0] < 0 || fd[1] < 0) {
+        uint64_t c, n;
+        stop(c, n);
+        return false;
+    }
+    for (int i = 0; i < 2; ++i) {
+        ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool PerfCounters::stop(uint64_t& cycles, uint64_t& instructions)
+{
+    uint64_t v[2] = {};
+    bool ok = fd[0] >= 0 && fd[1] >= 0;
+
+#if defined(__linux__)
+    for (int i = 0; i < 2; ++i)
+        if (fd[i] >= 0) {
+            ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            ok &= read(fd[i], &v[i], sizeof(v[i])) == sizeof(v[i]);
+            close(fd[i]);
+            fd[i] = -1;
+        }
+#endif
+    cycles = v[0];
+    instructions = v[1];
+    return ok;
+}
+
+/// Number of physical cores available to the process, used by '-t auto'
+size_t physical_cores()
+{
+    std::vector<Cpu> cpus = cpu_topology();
+    std::vector<std::pair<int, int>> cores;
+
+    for (const Cpu& c : cpus)
+        cores.push_back({ c.package, c.core });
+
+    std::sort(cores.begin(), cores.end());
+    return std::unique(cores.begin(), cores.end()) - cores.begin();
+}
+
+namespace {
+
 /// Create, run and retire threads of execution, needed data is passed through
 /// the wrapping Thread object. New threads are created every time run is called.
-void run(const Spot& s, size_t gamesNum, size_t threadsNum,
-    bool enumerate, Result results[])
+/// Threads take chunks of work on demand until all are played, shard i of n
+/// plays only chunks k with k % n == i. The counters of the first players are
+/// summed into results.
+///
+/// With a binding policy each thread is bound to its CPU before allocating its
+/// Thread object, so that the per-thread copy of the Spot and the counters are
+/// first touched, and so placed, on the NUMA node local to the thread.
+void run_threads(const Spot& s, size_t players, size_t gamesNum, size_t threadsNum,
+    Mode mode, Result results[], const Outputs& out, const Shard& shard, Binding binding)
 {
+    Streets* st = out.streets;
+    Matrix* mx = out.matrix;
+    Compare* cmp = out.compare;
+    Estimate* est = out.estimate;
+    Categories* ct = out.categories;
+    Checkpoint* cp = out.checkpoint;
+
     std::vector<Thread*> threads; // Pointers because std::vector reallocates
+    std::vector<uint64_t> enumBuf;
+    Result base[PLAYERS_NB] = {}; // Counters saved in a checkpoint
+    Spot spot = s;
+    Work work;
+
+    // Omaha boards are unranked by each thread, no buffer is needed. Otherwise
+    // the enumeration buffer is computed once and shared among the threads.
+    if ((mode & OMAHA) && (mode & ENUMERATE)) {
+        gamesNum = out.omaha->boards();
+        if (!gamesNum)
+            return;
+    }
+    else if (mode & ENUMERATE) {
+        gamesNum = spot.set_enumerate(enumBuf);
+        if (!gamesNum)
+            return;
+        work.entries = enumBuf.size() / gamesNum;
+    }
+    // Against random opponents games are split evenly among the runouts, when
+    // heads-up a runout is a single chunk counted exactly.
+    if (mode & VS_RANDOM)
+        gamesNum = players == 2 ? 1 : std::max(gamesNum / spot.runouts(), size_t(1));
+
+    work.enumBuf = enumBuf.data();
+    work.gamesNum = gamesNum;
+    work.parts = (gamesNum + ChunkGames - 1) / ChunkGames;
+    work.next = shard.idx;
+    work.step = shard.num;
+    work.end = mode & STRATIFIED    ? est->strata.size()
+             : mode & VS_RANDOM     ? spot.runouts() * work.parts
+             : mode & RUNOUTS       ? out.runouts->boards.size()
+             : mode & HAND_STRENGTH ? out.strength->boards.size()
+             : mode & SPOTS         ? out.batch->spots.size() : work.parts;
+
+    if (mode & RUNOUTS)
+        out.runouts->results.assign(out.runouts->boards.size() * PLAYERS_NB, Result());
+
+    if (mode & SPOTS)
+        out.batch->results.assign(out.batch->spots.size() * PLAYERS_NB, Result());
+
+    if (cp && cp->resumed) {
+        work.next = cp->next;
+        work.redo = cp->pending;
+        std::copy(cp->results, cp->results + PLAYERS_NB, base);
+    }
+
+    // No more threads than chunks of work
+    size_t chunksNum = work.redo.size()
+                     + (work.next < work.end ? (work.end - work.next - 1) / work.step + 1 : 0);
+    threadsNum = std::max(std::min(threadsNum, chunksNum), size_t(1));
+
+    // A single thread without checkpoints runs inline in the calling thread,
+    // saving the spawn latency on small queries.
+    bool inlined = threadsNum == 1 && !cp;
 
-    if (gamesNum < threadsNum)
-        threadsNum = 1;
+    std::vector<int> cpus;
+    if (binding != NO_BINDING && !inlined)
+        cpus = binding_order(binding);
 
-    size_t n = gamesNum / threadsNum;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> finished(0);
+    threads.resize(threadsNum);
 
-    for (size_t i = 0; i < threadsNum; ++i)
-        threads.push_back(new Thread(i, s, n, threadsNum, enumerate));
+    auto worker = [&](size_t i) {
+        if (cpus.size())
+            bind_this_thread(cpus[i % cpus.size()]);
 
+        Thread* th = new Thread(spot, out, &work);
+        {
+            std::lock_guard<std::mutex> lock(work.mutex);
+            threads[i] = th;
+        }
+        th->run(mode);
+        finished++;
+    };
+
+    if (inlined)
+        worker(0);
+    else
+        for (size_t i = 0; i < threadsNum; ++i)
+            workers.emplace_back(worker, i);
+
+    // Save a checkpoint every interval seconds until all threads are finished
+    if (cp) {
+        auto last = std::chrono::steady_clock::now();
+
+        while (finished < threadsNum) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+            if (std::chrono::steady_clock::now() - last >= std::chrono::seconds(cp->interval)) {
+                save_checkpoint(*cp, work, threads, base);
+                last = std::chrono::steady_clock::now();
+            }
+        }
+    }
+
+    for (std::thread& w : workers)
+        w.join(); // Wait here for thread finished
+
+    for (size_t p = 0; p < players; ++p) {
+        results[p].first += base[p].first;
+        results[p].second += base[p].second;
+    }
     for (Thread* th : threads) {
-        th->join(); // Wait here for thread finished
-        for (size_t p = 0; p < s.players(); ++p) {
+        for (size_t p = 0; p < players; ++p) {
             results[p].first += th->result(p).first;
             results[p].second += th->result(p).second;
         }
+        if (st) {
+            const Streets& ts = th->street_results();
+            for (int r = 0; r < 2; ++r) {
+                st->games[r] += ts.games[r];
+                for (size_t p = 0; p < players; ++p) {
+                    st->equity[r][p] += ts.equity[r][p];
+                    for (int b = 0; b < BINS_NB; ++b)
+                        st->histo[r][p][b] += ts.histo[r][p][b];
+                }
+            }
+        }
+        if (ct) {
+            const Categories& tc = th->category_results();
+            for (size_t p = 0; p < players; ++p)
+                for (int c = 0; c < CATEGORY_NB; ++c) {
+                    ct->made[p][c] += tc.made[p][c];
+                    ct->won[p][c].first += tc.won[p][c].first;
+                    ct->won[p][c].second += tc.won[p][c].second;
+                }
+        }
+        if (mx) {
+            const Matrix& tm = th->matrix_results();
+            for (size_t c = 0; c < mx->combos.size(); ++c) {
+                mx->results[c].first += tm.results[c].first;
+                mx->results[c].second += tm.results[c].second;
+                mx->games[c] += tm.games[c];
+            }
+        }
+        if (cmp) {
+            const Compare& tc = th->compare_results();
+            for (size_t k = 0; k < cmp->spots.size(); ++k) {
+                cmp->sum[k] += tc.sum[k];
+                cmp->sumSq[k] += tc.sumSq[k];
+                cmp->diff[k] += tc.diff[k];
+                cmp->diffSq[k] += tc.diffSq[k];
+            }
+            cmp->games += tc.games;
+        }
+        if (est) {
+            const Estimate& te = th->estimate_results();
+            for (size_t p = 0; p < players; ++p) {
+                est->sum[p] += te.sum[p];
+                est->sumSq[p] += te.sumSq[p];
+                est->mean[p] += te.mean[p];
+                est->var[p] += te.var[p];
+            }
+            est->samples += te.samples;
+        }
         delete th;
     }
+
+    // Run is complete, checkpoint is not needed anymore
+    if (cp)
+        std::remove(cp->file.c_str());
+}
+
+} // namespace
+
+/// Play the games of a spot, see run_threads()
+void run(const Spot& s, size_t gamesNum, size_t threadsNum, Mode mode,
+    Result results[], const Outputs& out, const Shard& shard, Binding binding)
+{
+    run_threads(s, s.players(), gamesNum, threadsNum, mode, results, out, shard, binding);
 }
 
-/// Populate ScoreMask[] at startup. Table is indexed by the 2 highest bits of
+/// Run of the modes that carry all their work in out, with no spot to play:
+/// Omaha, hand strength tables and batches of spots. The counters of the given
+/// number of players are summed into results.
+void run(size_t players, size_t gamesNum, size_t threadsNum, Mode mode,
+    Result results[], const Outputs& out, const Shard& shard, Binding binding)
+{
+    run_threads(Spot(), players, gamesNum, threadsNum, mode, results, out, shard, binding);
+}
+
+bool load_checkpoint(const string& file, Checkpoint& cp)
+{
+    ifstream f(file);
+    string token, version;
+    size_t pendingNum = 0;
+
+    f >> token >> version;
+    if (token != "checkpoint" || version != "3") {
+        cerr << "Cannot read checkpoint file: " << file << endl;
+        return false;
+    }
+    f >> token;
+    getline(f >> ws, cp.cmd);
+    f >> token >> cp.interval >> token >> cp.next >> token >> pendingNum;
+
+    cp.file = file;
+    cp.resumed = true;
+    cp.pending.resize(pendingNum);
+
+    for (uint64_t& k : cp.pending)
+        f >> k;
+
+    f >> token;
+    for (int p = 0; p < PLAYERS_NB; ++p)
+        f >> cp.results[p].first >> cp.results[p].second;
+
+    if (!f) {
+        cerr << "Corrupted checkpoint file: " << file << endl;
+        return false;
+    }
+    return true;
+}
+
+/// Populate the ScoreMask[] table of deck D at startup. Table is indexed by the 2 highest bits of
 /// the score value that correspond to the hand's best combination (for instance
 /// a set and a pair). Given these 2 keys, the table is built such that a bitwise
 /// AND with the score produces the following:
@@ -118,11 +976,16 @@ void run(const Spot& s, size_t gamesNum, size_t threadsNum,
 /// - Set the number of bits that should remain in score's first rank, so that
 ///   the score uses just the best 5 cards out of 7.
 ///
+/// Then populate CategoryOf[] of deck D, out of the flags of the categories.
+///
+template<typename D>
 void init_score_mask()
 {
+    uint64_t* mask = ScoreMask[D::Index];
+
     // Fixed mask to clear the 3-bit counter and some flags that eventually
     // will be re-added when neded on specific cases (like double pair).
-    constexpr uint64_t Init = ~(FullHouseBB | DoublePairBB | set_counter(7));
+    constexpr uint64_t Init = ~(D::FullHouseBB | DoublePairBB | set_counter(7));
 
     for (unsigned c1 = 0; c1 < 64; c1++) {
 
@@ -145,49 +1008,154 @@ void init_score_mask()
             uint64_t l = 1ULL << c2;
 
             // Init and clear the columns below the 2 most significant bits
-            ScoreMask[idx] = Init & clear_below(h) & clear_below(l);
+            mask[idx] = Init & clear_below(h) & clear_below(l);
 
             // High card. Set counter to pick the 5 msb bits in score's first rank
             if (h & Rank1BB)
-                ScoreMask[idx] |= set_counter(5);
+                mask[idx] |= set_counter(5);
 
             // Single pair, we just need highest 3 bit of score's first rank
             else if ((h & Rank2BB) && (l & Rank1BB))
-                ScoreMask[idx] |= set_counter(3);
+                mask[idx] |= set_counter(3);
 
             // Double Pair. Use clear_before(l) to drop any possible third pair
             // that should not influence the score.
             else if ((h & Rank2BB) && (l & Rank2BB)) {
-                ScoreMask[idx] &= clear_before(l);
-                ScoreMask[idx] |= set_counter(1) | DoublePairBB;
+                mask[idx] &= clear_before(l);
+                mask[idx] |= set_counter(1) | DoublePairBB;
             }
             // Single Set. Nothing fancy.
             else if ((h & Rank3BB) && (l & Rank1BB))
-                ScoreMask[idx] |= set_counter(2);
+                mask[idx] |= set_counter(2);
 
             // Full house. Use clear_before(l) to drop any possible second pair
             // that should not influence the score.
             else if ((h & Rank3BB) && (l & Rank2BB)) {
-                ScoreMask[idx] &= clear_before(l);
-                ScoreMask[idx] |= set_counter(0) | FullHouseBB;
+                mask[idx] &= clear_before(l);
+                mask[idx] |= set_counter(0) | D::FullHouseBB;
             }
             // Double set. It's a full house, second set is counted as a pair,
             // so use clear_before(h), not clear_before(l) as in double pair.
             else if ((h & Rank3BB) && (l & Rank3BB)) {
-                ScoreMask[idx] &= clear_before(h);
+                mask[idx] &= clear_before(h);
                 // Re-add the (shifted) bit dropped by clear_below(h, l)
-                ScoreMask[idx] |= (l >> 16) | set_counter(0) | FullHouseBB;
+                mask[idx] |= (l >> 16) | set_counter(0) | D::FullHouseBB;
             }
             // Quad. Drop anything but first rank. Re-add the bit on first
             // rank in the column of l, that was dropped by clear_below(h, l)
             else if ((h & Rank4BB)) {
-                ScoreMask[idx] ^= ~clear_below(l); // Re-add bits below l
-                ScoreMask[idx] &= ~(Rank3BB | Rank2BB);
-                ScoreMask[idx] |= set_counter(1);
+                mask[idx] ^= ~clear_below(l); // Re-add bits below l
+                mask[idx] &= ~(Rank3BB | Rank2BB);
+                mask[idx] |= set_counter(1);
             } else
                 assert(false);
         }
     }
+
+    for (unsigned b = 0; b < 64; ++b) {
+        uint64_t bb = 1ULL << b;
+        CategoryOf[D::Index][b] = bb == StraightFlushBB ? STRAIGHT_FLUSH
+                                : bb & Rank4BB          ? QUADS
+                                : bb == D::FullHouseBB  ? FULL_HOUSE
+                                : bb == D::FlushBB      ? FLUSH
+                                : bb == StraightBB      ? STRAIGHT
+                                : bb & Rank3BB          ? TRIPS
+                                : bb == DoublePairBB    ? TWO_PAIR
+                                : bb & Rank2BB          ? PAIR : HIGH_CARD;
+    }
+}
+
+void init_score_mask()
+{
+    init_score_mask<FullDeck>();
+    init_score_mask<ShortDeck>();
+}
+
+uint32_t TableEval::Keys[8192];
+uint16_t TableEval::Flushes[8192];
+std::vector<uint16_t> TableEval::Classes;
+std::vector<uint64_t> TableEval::Scores;
+
+/// Build the tables of the TableEval backend on first use. Scores are the ones
+/// of do_score() on all the 7 cards hands: flushes by the ranks of the suit, and
+/// the other hands by the multiset of their ranks, dealt round robin among the
+/// suits so that no flush is made. Keys of the ranks are such that the sums of
+/// any 7 of them, up to 4 of a kind, are all different.
+void TableEval::init()
+{
+    constexpr uint32_t RankKey[] = { 0, 1, 5, 22, 98, 453, 2031, 8698, 22854, 83661,
+                                     262349, 636345, 1479181 };
+    if (!Scores.empty())
+        return;
+
+    for (unsigned m = 0; m < 8192; ++m) {
+        Keys[m] = 0;
+        for (unsigned r = 0; r < 13; ++r)
+            if (m & (1 << r))
+                Keys[m] += RankKey[r];
+    }
+
+    vector<pair<uint32_t, uint64_t>> hands; // Key and score of a multiset
+    vector<pair<unsigned, uint64_t>> flushes;
+    unsigned cnt[13] = {};
+
+    // Multisets of 7 ranks with up to 4 cards each, as counts per rank
+    std::function<void(unsigned, unsigned)> multisets = [&](unsigned r, unsigned left) {
+        if (r == 13) {
+            if (left)
+                return;
+            Hand h = Hand();
+            uint32_t key = 0;
+            h.suits = SuitInit;
+            for (unsigned v = 0, n = 0; v < 13; ++v)
+                for (unsigned i = 0; i < cnt[v]; ++i, ++n)
+                    h.add(Card(16 * (n % 4) + v), 0), key += RankKey[v];
+            h.do_score();
+            hands.push_back({ key, h.score });
+            return;
+        }
+        for (cnt[r] = 0; cnt[r] <= std::min(4U, left); ++cnt[r])
+            if (!cnt[r] || !(Deck::Absent & (1ULL << r)))
+                multisets(r + 1, left - cnt[r]);
+        cnt[r] = 0;
+    };
+    multisets(0, 7);
+
+    for (unsigned m = 0; m < 8192; ++m)
+        if (popcount(m) >= 5 && popcount(m) <= 7 && !(Deck::Absent & m)) {
+            Hand h = Hand();
+            h.suits = SuitInit;
+            for (uint64_t b = m; b; )
+                h.add(Card(pop_lsb(&b)), 0);
+            h.do_score();
+            flushes.push_back({ m, h.score });
+        }
+
+    for (auto& h : hands)
+        Scores.push_back(h.second);
+    for (auto& f : flushes)
+        Scores.push_back(f.second);
+
+    std::sort(Scores.begin(), Scores.end());
+    Scores.erase(std::unique(Scores.begin(), Scores.end()), Scores.end());
+
+    auto cls = [](uint64_t sc) {
+        return uint16_t(std::lower_bound(Scores.begin(), Scores.end(), sc) - Scores.begin());
+    };
+
+    Classes.assign(4 * RankKey[12] + 3 * RankKey[11] + 1, 0);
+    for (auto& h : hands)
+        Classes[h.first] = cls(h.second);
+
+    std::fill(Flushes, Flushes + 8192, 0);
+    for (auto& f : flushes)
+        Flushes[f.first] = cls(f.second);
+}
+
+size_t TableEval::memory()
+{
+    return sizeof(Keys) + sizeof(Flushes) + Classes.size() * sizeof(uint16_t)
+         + Scores.size() * sizeof(uint64_t);
 }
 
 const string pretty64(uint64_t b, bool headers)
@@ -245,9 +1213,9 @@ ostream& operator<<(ostream& os, const Hand& h)
     return os;
 }
 
-void pretty_results(Result* results, size_t players)
+void pretty_results(Result* results, size_t players, const Categories* ct)
 {
-    size_t games = 0;
+    uint64_t games = 0;
     for (size_t p = 0; p < players; p++)
         games += KTie * results[p].first + results[p].second;
     games /= KTie;
@@ -257,11 +1225,156 @@ void pretty_results(Result* results, size_t players)
 
     for (size_t p = 0; p < players; p++) {
         cout << "P" << p + 1 << ": ";
-        size_t equity = KTie * results[p].first + results[p].second;
+        uint64_t equity = KTie * results[p].first + results[p].second;
+        // Split tie shares in whole pots and remainder, to not lose precision
+        // converting large counters to double.
+        double tied = double(results[p].second / KTie)
+                    + double(results[p].second % KTie) / KTie;
         cout << std::setw(6) << equity * 100.0 / KTie / games << "% "
              << std::setw(6) << results[p].first * 100.0 / games << "% "
-             << std::setw(6) << results[p].second * 100.0 / KTie / games << "% "
+             << std::setw(6) << tied * 100.0 / games << "% "
              << std::setw(9) << results[p].first << " "
-             << std::setw(9) << double(results[p].second) / KTie << endl;
+             << std::setw(9) << tied << '\n';
+    }
+
+    // For each category the games a player finishes with it, and the pots won
+    // with it, ties included as shares, in percent of all the games.
+    if (ct) {
+        const char* names[] = { "High", "Pair", "2 Pair", "Trips", "Straight",
+                                "Flush", "Full", "Quads", "St Flush" };
+
+        cout << "\n        ";
+        for (int c = 0; c < CATEGORY_NB; ++c)
+            cout << std::setw(9) << names[c];
+        cout << '\n';
+
+        for (size_t p = 0; p < players; p++) {
+            cout << "P" << p + 1 << " made:";
+            for (int c = 0; c < CATEGORY_NB; ++c)
+                cout << std::setw(8) << ct->made[p][c] * 100.0 / games << "%";
+            cout << "\n   won: ";
+            for (int c = 0; c < CATEGORY_NB; ++c) {
+                const Result& r = ct->won[p][c];
+                cout << std::setw(8) << (KTie * r.first + r.second) * 100.0 / KTie / games << "%";
+            }
+            cout << '\n';
+        }
+    }
+    cout.flush();
+}
+
+void pretty_streets(const Streets& st, size_t players)
+{
+    const char* names[] = { "Flop", "Turn" };
+
+    for (int r = 0; r < 2; ++r) {
+        if (!st.games[r])
+            continue;
+
+        cout << "\n" << names[r] << " equity distribution over " << st.games[r]
+             << " runouts\n      Mean ";
+        for (int b = 0; b < BINS_NB; ++b)
+            cout << std::setw(4) << 100 * b / BINS_NB << "-" << std::setw(3) << std::left
+                 << 100 * (b + 1) / BINS_NB << std::right;
+        cout << "\n";
+
+        for (size_t p = 0; p < players; p++) {
+            cout << "P" << p + 1 << ": " << std::setw(6)
+                 << st.equity[r][p] * 100.0 / st.games[r] << "%";
+            for (int b = 0; b < BINS_NB; ++b)
+                cout << std::setw(7) << st.histo[r][p][b] * 100.0 / st.games[r] << "%";
+            cout << endl;
+        }
+    }
+}
+
+void pretty_matrix(const Matrix& mx)
+{
+    const string Values = "23456789TJQKA";
+    uint64_t eq[13][13] = {}, games[13][13] = {};
+
+    cout << std::showpoint << std::noshowpos << std::fixed << std::setprecision(2)
+         << "\nCombo   Equity      Games\n";
+
+    for (size_t c = 0; c < mx.combos.size(); ++c) {
+        uint64_t v = mx.combos[c].cards;
+        Card c2 = Card(pop_lsb(&v)), c1 = Card(lsb(v));
+        if ((c1 & 0xF) < (c2 & 0xF))
+            std::swap(c1, c2);
+
+        // Pairs on diagonal, suited above it and offsuit below as usual
+        unsigned r1 = 12 - (c1 & 0xF), r2 = 12 - (c2 & 0xF);
+        if ((c1 >> 4) != (c2 >> 4))
+            std::swap(r1, r2);
+
+        eq[r1][r2] += KTie * mx.results[c].first + mx.results[c].second;
+        games[r1][r2] += mx.games[c];
+
+        cout << c1 << c2 << std::setw(6)
+             << (mx.games[c] ? (KTie * mx.results[c].first + mx.results[c].second)
+                                * 100.0 / KTie / mx.games[c] : 0.0)
+             << "% " << std::setw(10) << mx.games[c] << endl;
+    }
+
+    cout << std::setprecision(1) << "\n    ";
+    for (int r = 12; r >= 0; --r)
+        cout << std::setw(6) << Values[r];
+    cout << "\n";
+
+    for (int r1 = 0; r1 < 13; ++r1) {
+        cout << "  " << Values[12 - r1] << " ";
+        for (int r2 = 0; r2 < 13; ++r2)
+            if (games[r1][r2])
+                cout << std::setw(6) << eq[r1][r2] * 100.0 / KTie / games[r1][r2];
+            else
+                cout << "     -";
+        cout << endl;
+    }
+}
+
+void pretty_compare(const Compare& cmp, const std::vector<std::string>& names)
+{
+    // Half width of the 95% confidence interval of the mean, in percent
+    auto ci = [&](double sum, double sumSq) {
+        double n = double(cmp.games);
+        double var = n > 1 ? (sumSq - sum * sum / n) / (n - 1) : 0;
+        return 196.0 * std::sqrt(std::max(var, 0.0) / n);
+    };
+
+    cout << std::showpoint << std::noshowpos << std::fixed << std::setprecision(3)
+         << "\nP1 equity over " << cmp.games << " games with common random numbers\n"
+         << "\n        Equity  95% CI      Diff  95% CI  Independent CI\n";
+
+    for (size_t k = 0; k < cmp.spots.size(); ++k) {
+        cout << "S" << k + 1 << ": " << std::setw(8) << cmp.sum[k] * 100 / cmp.games
+             << "% " << std::setw(7) << ci(cmp.sum[k], cmp.sumSq[k]) << "%";
+
+        if (k) {
+            double i0 = ci(cmp.sum[0], cmp.sumSq[0]), ik = ci(cmp.sum[k], cmp.sumSq[k]);
+            cout << std::setw(9) << cmp.diff[k] * 100 / cmp.games << "% "
+                 << std::setw(7) << ci(cmp.diff[k], cmp.diffSq[k]) << "% "
+                 << std::setw(14) << std::sqrt(i0 * i0 + ik * ik) << "%";
+        }
+        cout << "  " << names[k] << endl;
+    }
+}
+
+void pretty_estimate(const Estimate& e, size_t players)
+{
+    cout << std::showpoint << std::noshowpos << std::fixed << std::setprecision(3)
+         << "\nEstimate over " << e.samples << " samples\n"
+         << "\n     Equity  Std. error  95% CI\n";
+
+    for (size_t p = 0; p < players; p++) {
+        double mean = e.mean[p], var = e.var[p], n = double(e.samples);
+
+        if (e.strata.empty()) {
+            mean = e.sum[p] / n;
+            var = (e.sumSq[p] - e.sum[p] * mean) / (n - 1) / n;
+        }
+        double se = std::sqrt(std::max(var, 0.0));
+
+        cout << "P" << p + 1 << ": " << std::setw(7) << mean * 100 << "% "
+             << std::setw(9) << se * 100 << "% " << std::setw(6) << 196 * se << "%" << endl;
     }
 }
@@ -5,24 +5,40 @@
 #include <cassert>
 #include <cstdint>
 #include <string>
+#include <vector>
 
-typedef std::pair<unsigned, unsigned> Result;
+#if defined(_MSC_VER) && !defined(NO_PREFETCH)
+#include <xmmintrin.h> // Microsoft header for _mm_prefetch()
+#endif
+
+/// Per player count of games won and of tie shares in units of 1/KTie. 64 bit
+/// counters do not overflow even in runs of many billions of games.
+typedef std::pair<uint64_t, uint64_t> Result;
+
+struct Streets;
+struct Categories;
+struct Matrix;
+struct Compare;
+struct Estimate;
+struct Checkpoint;
 
-/// A constant divisible by 2,3,4,5,6 used to score split results
-constexpr unsigned KTie = 60;
+/// A constant divisible by 2,3,..,10 used to score split results, so that the
+/// share of a pot split among up to 10 players is always exact.
+constexpr unsigned KTie = 2520;
 
 /// Our PRNG class is a wrapper around Xoroshiro128+. Used for Monte Carlo
 class PRNG {
 
     uint64_t s[2];
-    uint64_t* buf;
+    const uint64_t* buf;
 
     void jump(void);
 
 public:
     PRNG(size_t idx, uint64_t seed = 0);
     uint64_t next();
-    void set_enum_buffer(uint64_t* b) { buf = b; }
+    void set_enum_buffer(const uint64_t* b) { buf = b; }
+    void seed(uint64_t k);
 };
 
 /// popcount() counts the number of non-zero bits in a uint64_t
@@ -138,6 +154,31 @@ inline unsigned pop_msb(uint64_t* b)
     return s;
 }
 
+/// prefetch() preloads the cache line of the given address, without waiting.
+/// It is a no-op when built with prefetch=no.
+inline void prefetch(const void* addr)
+{
+#ifdef NO_PREFETCH
+
+    (void)addr;
+
+#elif defined(_MSC_VER)
+
+    _mm_prefetch((const char*)addr, _MM_HINT_T0);
+
+#else
+
+    __builtin_prefetch(addr);
+
+#endif
+}
+
+/// more_than_one() returns true if in a bitboard there is more than one bit set
+inline bool more_than_one(uint64_t b)
+{
+    return b & (b - 1);
+}
+
 /// msb_bb() returns as a bitboard the most significant bit in a non-zero bitboard
 inline uint64_t msb_bb(uint64_t b)
 {
@@ -146,6 +187,29 @@ inline uint64_t msb_bb(uint64_t b)
 
 /// Pretty printers of a uint64_t in "table of bits" format and of equity results
 extern const std::string pretty64(uint64_t b, bool headers = false);
-extern void pretty_results(Result* results, size_t players);
+extern void pretty_results(Result* results, size_t players,
+                           const Categories* ct = nullptr);
+extern void pretty_streets(const Streets& st, size_t players);
+extern void pretty_matrix(const Matrix& mx);
+extern void pretty_compare(const Compare& cmp, const std::vector<std::string>& names);
+extern void pretty_estimate(const Estimate& e, size_t players);
+
+/// Read back the state of a run saved by run() in a checkpoint file
+extern bool load_checkpoint(const std::string& file, Checkpoint& cp);
+
+/// Hardware counters of the cycles and of the instructions retired by the calling
+/// thread, and by the threads it starts later, between start() and stop(). They
+/// are available on Linux when perf events are allowed, both return false when
+/// they are not.
+struct PerfCounters {
+    int fd[2] = { -1, -1 };
+
+    bool start();
+    bool stop(uint64_t& cycles, uint64_t& instructions);
+};
+
+/// Map a file read-only in memory and release it
+extern const void* map_file(const std::string& file, size_t& size);
+extern void unmap_file(const void* p, size_t size);
 
 #endif // #ifndef UTIL_H_INCLUDED
@@ -65,6 +65,18 @@ PRNG::PRNG(size_t idx, uint64_t seed) {
         jump();
 }
 
+/* Seed the state with a splitmix64 generator started from k, so that
+   different values of k give unrelated streams. */
+
+void PRNG::seed(uint64_t k) {
+    for (int i = 0; i < 2; i++) {
+        uint64_t z = (k += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        s[i] = z ^ (z >> 31);
+    }
+}
+
 /* This is the jump function for the generator. It is equivalent
    to 2^64 calls to next(); it can be used to generate 2^64
    non-overlapping subsequences for parallel computations. */